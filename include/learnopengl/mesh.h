@@ -7,6 +7,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <rg/GLStateCache.h>
 
 #include <string>
 #include <vector>
@@ -31,6 +32,7 @@ struct Texture {
     unsigned int id;
     string type;
     string path;
+    bool transparent = false; // has texels with alpha below the shaders' alpha test threshold
 };
 
 class Mesh {
@@ -42,12 +44,21 @@ public:
 
     unsigned int VAO;
     std::string glslIdentifierPrefix;
+    // axis aligned bounding box of the vertices, in model space
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // the diffuse texture has holes, the mesh has to be drawn with an alpha tested shader
+    bool alphaTest = false;
+    // meshes of a model with the same textures have the same material index (set by Model), for sorting draws
+    unsigned int material = 0;
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        for(const Texture& texture: textures)
+            alphaTest |= texture.type == "texture_diffuse" && texture.transparent;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
@@ -63,7 +74,6 @@ public:
         unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -77,20 +87,16 @@ public:
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
 
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            shader.setInt(glslIdentifierPrefix + name + number, i);
+            // and finally bind the texture, the cache skips what the previous mesh already bound
+            glState().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
         }
 
 
 
-        // draw mesh
-        glBindVertexArray(VAO);
+        // draw mesh, the vertex array stays bound for whoever draws next
+        glState().bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
 private:
@@ -105,7 +111,7 @@ private:
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        glState().bindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
@@ -133,7 +139,7 @@ private:
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
-        glBindVertexArray(0);
+        glState().bindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
@@ -4,11 +4,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
 #include <common.h>
+#include <rg/GLStateCache.h>
 class Shader
 {
 public:
@@ -16,6 +21,12 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+            : Shader(vertexPath, fragmentPath, std::string(), geometryPath)
+    {
+    }
+    // same as above, `defines` ("#define NAME value" lines) is inserted right after the #version line of every stage
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines, const char* geometryPath = nullptr)
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -64,6 +75,13 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if(!defines.empty())
+        {
+            vertexCode = injectDefines(vertexCode, defines);
+            fragmentCode = injectDefines(fragmentCode, defines);
+            if(geometryPath != nullptr)
+                geometryCode = injectDefines(geometryCode, defines);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -101,74 +119,281 @@ public:
         glDeleteShader(fragment);
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
-
+        // resolve every active uniform once so setters never have to ask the driver
+        reflectUniforms();
+    }
+    // transform feedback program: a vertex shader alone whose outputs `varyings` are captured into buffers
+    // (one buffer per varying for GL_SEPARATE_ATTRIBS), nothing is rasterized
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const std::vector<const char*> &varyings, GLenum bufferMode = GL_SEPARATE_ATTRIBS)
+    {
+        std::string vertexCode;
+        std::ifstream vShaderFile;
+        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            vShaderFile.open(vertexPath);
+            std::stringstream vShaderStream;
+            vShaderStream << vShaderFile.rdbuf();
+            vShaderFile.close();
+            vertexCode = vShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* vShaderCode = vertexCode.c_str();
+        unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        // the captured outputs have to be known before linking
+        glTransformFeedbackVaryings(ID, varyings.size(), varyings.data(), bufferMode);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(vertex);
+        reflectUniforms();
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
-        glUseProgram(ID); 
+        glState().useProgram(ID);
+    }
+    // returns a handle to an active uniform (or -1 if the uniform is not active).
+    // resolve handles once at setup and pass them to the setters below in hot loops,
+    // array members are addressed by their full name, e.g. "pointLight[3].position"
+    // ------------------------------------------------------------------------
+    int getUniform(const std::string &name) const
+    {
+        auto it = uniformSlots.find(name);
+        return it == uniformSlots.end() ? -1 : it->second;
+    }
+    // assigns a named uniform block of this program to a uniform buffer binding point
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string &name, unsigned int binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+        if(index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setInt(getUniform(name), (int)value);
+    }
+    void setBool(int uniform, bool value) const
+    {
+        setInt(uniform, (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(getUniform(name), value);
+    }
+    void setInt(int uniform, int value) const
+    {
+        if(valueChanged(uniform, &value, 1))
+            glUniform1i(slots[uniform].location, value);
+    }
+    // sets the first `count` elements of an int array, `uniform` is the handle of "name[0]"
+    void setIntArray(int uniform, const int *values, int count) const
+    {
+        if(uniform < 0 || count <= 0)
+            return;
+        // elements of an array get consecutive slots, see reflectUniforms
+        bool changed = false;
+        for(int i = 0; i < count; i++)
+            changed |= valueChanged(uniform + i, &values[i], 1);
+        if(changed)
+            glUniform1iv(slots[uniform].location, count, values);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(getUniform(name), value);
+    }
+    void setFloat(int uniform, float value) const
+    {
+        if(valueChanged(uniform, &value, 1))
+            glUniform1f(slots[uniform].location, value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(getUniform(name), value);
+    }
+    void setVec2(int uniform, const glm::vec2 &value) const
+    {
+        if(valueChanged(uniform, &value[0], 2))
+            glUniform2fv(slots[uniform].location, 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setVec2(getUniform(name), glm::vec2(x, y));
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(getUniform(name), value);
+    }
+    void setVec3(int uniform, const glm::vec3 &value) const
+    {
+        if(valueChanged(uniform, &value[0], 3))
+            glUniform3fv(slots[uniform].location, 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setVec3(getUniform(name), glm::vec3(x, y, z));
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(getUniform(name), value);
+    }
+    void setVec4(int uniform, const glm::vec4 &value) const
+    {
+        if(valueChanged(uniform, &value[0], 4))
+            glUniform4fv(slots[uniform].location, 1, &value[0]);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setVec4(getUniform(name), glm::vec4(x, y, z, w));
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(getUniform(name), mat);
+    }
+    void setMat2(int uniform, const glm::mat2 &mat) const
+    {
+        if(valueChanged(uniform, &mat[0][0], 4))
+            glUniformMatrix2fv(slots[uniform].location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(getUniform(name), mat);
+    }
+    void setMat3(int uniform, const glm::mat3 &mat) const
+    {
+        if(valueChanged(uniform, &mat[0][0], 9))
+            glUniformMatrix3fv(slots[uniform].location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(getUniform(name), mat);
+    }
+    void setMat4(int uniform, const glm::mat4 &mat) const
+    {
+        if(valueChanged(uniform, &mat[0][0], 16))
+            glUniformMatrix4fv(slots[uniform].location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // one entry per active uniform (every element of a uniform array gets its own entry)
+    struct UniformSlot {
+        GLint location;
+        unsigned int offset; // first word of the cached value in uniformValues
+        unsigned int words;  // size of the value in 32-bit words
+        bool cached;
+    };
+    std::unordered_map<std::string, int> uniformSlots;
+    mutable std::vector<UniformSlot> slots;
+    mutable std::vector<GLuint> uniformValues;
+
+    static unsigned int uniformTypeWords(GLenum type)
+    {
+        switch(type)
+        {
+            case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 2;
+            case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 3;
+            case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 4;
+            case GL_FLOAT_MAT3: return 9;
+            case GL_FLOAT_MAT4: return 16;
+            default: return 1; // scalars and samplers
+        }
+    }
+
+    void addUniformSlot(const std::string &name, GLint location, unsigned int words)
+    {
+        // uniforms inside named uniform blocks have no location
+        if(location < 0)
+            return;
+        uniformSlots[name] = (int)slots.size();
+        slots.push_back({location, (unsigned int)uniformValues.size(), words, false});
+        uniformValues.resize(uniformValues.size() + words);
+    }
+
+    // enumerates the active uniforms of the linked program. Arrays of basic types are reported once
+    // as "name[0]" with their size, so every element is resolved (and reachable as "name[i]") here.
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+        for(GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            GLenum type;
+            GLsizei length;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            unsigned int words = uniformTypeWords(type);
+            if(name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                for(GLint j = 0; j < size; j++)
+                {
+                    std::string element = base + "[" + std::to_string(j) + "]";
+                    addUniformSlot(element, glGetUniformLocation(ID, element.c_str()), words);
+                }
+                if(uniformSlots.count(name))
+                    uniformSlots[base] = uniformSlots[name];
+            }
+            else
+            {
+                addUniformSlot(name, glGetUniformLocation(ID, name.c_str()), words);
+            }
+        }
+    }
+
+    // compares the new value against the last one sent for this uniform and remembers it.
+    // the cache is per program, so it stays valid no matter which program is currently bound
+    bool valueChanged(int uniform, const void *value, unsigned int words) const
+    {
+        if(uniform < 0)
+            return false;
+        UniformSlot &slot = slots[uniform];
+        if(words > slot.words)
+            words = slot.words;
+        GLuint *cached = &uniformValues[slot.offset];
+        if(slot.cached && std::memcmp(cached, value, words * sizeof(GLuint)) == 0)
+            return false;
+        std::memcpy(cached, value, words * sizeof(GLuint));
+        slot.cached = true;
+        return true;
+    }
+
+    // #version has to stay the first statement. The #line directive keeps the compiler's line numbers matching
+    // the file (before GLSL 4.20 the line after "#line n" is numbered n + 1)
+    static std::string injectDefines(const std::string &code, const std::string &defines)
+    {
+        size_t version = code.find("#version");
+        if(version == std::string::npos)
+            return defines + "#line 0\n" + code;
+        size_t lineEnd = code.find('\n', version);
+        if(lineEnd == std::string::npos)
+            return code + "\n" + defines;
+        long versionLine = 1 + std::count(code.begin(), code.begin() + lineEnd, '\n');
+        return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(versionLine) + "\n" + code.substr(lineEnd + 1);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
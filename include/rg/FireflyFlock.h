@@ -0,0 +1,188 @@
+#ifndef PROJECT_BASE_FIREFLYFLOCK_H
+#define PROJECT_BASE_FIREFLYFLOCK_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <rg/FireflySystem.h>
+#include <rg/JobSystem.h>
+#include <rg/SpatialHashGrid.h>
+
+// Swarming fireflies (boids): every tick each firefly steers away from neighbours that are too close
+// (separation), towards the centre of its neighbours (cohesion) and towards their mean velocity
+// (alignment). The random retargets of FireflySystem stay as a wander impulse that is blended in.
+// Neighbours come from a SpatialHashGrid rebuilt every tick, so a tick is linear in the number of
+// fireflies, and at most MaxNeighbours are considered per firefly however dense the swarm gets.
+// All velocities of a tick are computed from the previous ones, in the grid's order, so the result
+// doesn't depend on the number of threads.
+class FireflyFlock {
+public:
+    struct Settings {
+        float radius = 1.0f;        // neighbourhood, also the cell size of the grid
+        float separation = 0.0005f; // per tick, the sum of the offsets from the neighbours over their squared distance
+        float cohesion = 0.0005f;   // per tick, the offset to the neighbours' centre
+        float alignment = 0.05f;    // fraction of the difference to the neighbours' mean velocity per tick
+        float wander = 0.5f;        // how much of a random retarget replaces the velocity
+    };
+
+    static const unsigned int MaxNeighbours = 16;
+
+    FireflyFlock() : grid(settings.radius) {
+    }
+
+    explicit FireflyFlock(const Settings& settings) : settings(settings), grid(settings.radius) {
+    }
+
+    const Settings& getSettings() const {
+        return settings;
+    }
+
+    void setSettings(const Settings& newSettings) {
+        if (newSettings.radius != settings.radius)
+            grid = SpatialHashGrid(newSettings.radius);
+        settings = newSettings;
+    }
+
+    // the grid of the last tick, fireflies at the positions before that tick's move
+    const SpatialHashGrid& getGrid() const {
+        return grid;
+    }
+
+    // one simulation tick: wander every retargetTicks (change number tick / retargetTicks of the random
+    // streams, as without flocking), rebuild the grid, steer and move. Jobs of `chunk` fireflies.
+    void tick(FireflySystem& fireflies, JobSystem& jobs, unsigned int chunk, uint64_t tick, uint64_t retargetTicks,
+              float maxSpeed, float yLimit) {
+        unsigned int n = fireflies.size();
+        nextVx.resize(n);
+        nextVy.resize(n);
+        nextVz.resize(n);
+
+        if (tick % retargetTicks == 0) {
+            // keep the old velocities aside, draw the random ones and mix them
+            swapVelocities(fireflies);
+            jobs.parallelFor(0, n, chunk, [this, &fireflies, tick, retargetTicks, maxSpeed, yLimit](unsigned int begin, unsigned int end) {
+                fireflies.retarget(begin, end, tick / retargetTicks, maxSpeed, yLimit);
+                wander(fireflies, begin, end);
+            });
+        }
+
+        // steering walks the fireflies in grid order, neighbours are close in memory
+        grid.build(fireflies.px.data(), fireflies.py.data(), fireflies.pz.data(), n, &jobs);
+        jobs.parallelFor(0, n, chunk, [this, &fireflies, maxSpeed](unsigned int begin, unsigned int end) {
+            steer(fireflies, begin, end, maxSpeed);
+        });
+        swapVelocities(fireflies);
+        jobs.parallelFor(0, n, chunk, [&fireflies, yLimit](unsigned int begin, unsigned int end) {
+            fireflies.integrate(begin, end, yLimit);
+        });
+    }
+
+private:
+    Settings settings;
+    SpatialHashGrid grid;
+    // the velocities being computed, swapped with the fireflies' ones
+    std::vector<float> nextVx, nextVy, nextVz;
+
+    void swapVelocities(FireflySystem& fireflies) {
+        std::swap(fireflies.vx, nextVx);
+        std::swap(fireflies.vy, nextVy);
+        std::swap(fireflies.vz, nextVz);
+    }
+
+    // fireflies hold the new random velocities, next the old ones
+    void wander(FireflySystem& fireflies, unsigned int begin, unsigned int end) {
+        float w = settings.wander;
+        for (unsigned int i = begin; i < end; i++) {
+            fireflies.vx[i] = nextVx[i] + w * (fireflies.vx[i] - nextVx[i]);
+            fireflies.vy[i] = nextVy[i] + w * (fireflies.vy[i] - nextVy[i]);
+            fireflies.vz[i] = nextVz[i] + w * (fireflies.vz[i] - nextVz[i]);
+        }
+    }
+
+    // velocities of the fireflies at [begin, end) of the grid order into next, each axis within
+    // [-maxSpeed, maxSpeed]. Consecutive fireflies mostly share a cell and so its neighbourhood.
+    void steer(const FireflySystem& fireflies, unsigned int begin, unsigned int end, float maxSpeed) {
+        const Settings& s = settings;
+        const float radius2 = s.radius * s.radius;
+        SpatialHashGrid::Range ranges[SpatialHashGrid::MaxRanges];
+        unsigned int nRanges = 0;
+        glm::ivec3 cell;
+        for (unsigned int k = begin; k < end; k++) {
+            unsigned int i = grid.index[k];
+            glm::vec3 p(grid.x[k], grid.y[k], grid.z[k]);
+            glm::ivec3 c = grid.cellOf(p);
+            if (k == begin || c != cell) {
+                cell = c;
+                nRanges = grid.neighbourhood(cell, ranges);
+            }
+
+            glm::vec3 velocity(fireflies.vx[i], fireflies.vy[i], fireflies.vz[i]);
+            glm::vec3 away(0.0f), centre(0.0f), heading(0.0f);
+            unsigned int neighbours = 0;
+            for (unsigned int r = 0; r < nRanges && neighbours < MaxNeighbours; r++) {
+                for (unsigned int l = ranges[r].begin; l < ranges[r].end && neighbours < MaxNeighbours; l++) {
+                    glm::vec3 offset = glm::vec3(grid.x[l], grid.y[l], grid.z[l]) - p;
+                    float distance2 = glm::dot(offset, offset);
+                    if (l == k || distance2 >= radius2)
+                        continue;
+                    unsigned int j = grid.index[l];
+                    away -= offset / std::max(distance2, 1e-4f);
+                    centre += offset;
+                    heading += glm::vec3(fireflies.vx[j], fireflies.vy[j], fireflies.vz[j]);
+                    neighbours++;
+                }
+            }
+            if (neighbours > 0) {
+                float inverse = 1.0f / neighbours;
+                velocity += away * s.separation + centre * (inverse * s.cohesion)
+                            + (heading * inverse - velocity) * s.alignment;
+                velocity = glm::clamp(velocity, glm::vec3(-maxSpeed), glm::vec3(maxSpeed));
+            }
+            nextVx[i] = velocity.x;
+            nextVy[i] = velocity.y;
+            nextVz[i] = velocity.z;
+        }
+    }
+};
+
+// time per flocking tick at 50k fireflies, spread over the forest and packed into a tight swarm,
+// on one thread and on all of them (--benchmark)
+inline void benchmarkFireflyFlock(std::ostream& out, JobSystem& jobs, unsigned int grain) {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned int n = 50000, ticks = 200;
+    JobSystem serial(0);
+    for (float extent: {50.0f, 10.0f}) {
+        for (unsigned int run = 0; run < 2; run++) {
+            JobSystem& pool = run == 0 ? serial : jobs;
+            unsigned int threads = pool.threadCount();
+            if (run == 1 && threads == 1)
+                continue;
+            FireflySystem fireflies(n);
+            for (unsigned int i = 0; i < n; i++) {
+                uint32_t key = randomKey(fireflies.seed, i);
+                fireflies.setPosition(i, glm::vec3(randomSigned(randomBits(key, 0)) * extent,
+                                                   randomSigned(randomBits(key, 1)) * 5.0f,
+                                                   randomSigned(randomBits(key, 2)) * extent));
+            }
+            fireflies.retarget(1, 0.01f, 5.0f);
+            FireflyFlock flock;
+
+            Clock::time_point start = Clock::now();
+            for (unsigned int tick = 1; tick <= ticks; tick++)
+                flock.tick(fireflies, pool, grain, tick, 180, 0.01f, 5.0f);
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            out << n << " fireflies flocking in " << 2 * extent << " x 10 x " << 2 * extent << ", "
+                << threads << " thread(s): " << seconds / ticks * 1e3 << " ms/tick"
+                << " (checksum " << fireflies.px[n / 2] + fireflies.py[n / 3] + fireflies.pz[n - 1] << ")\n";
+        }
+    }
+}
+
+#endif //PROJECT_BASE_FIREFLYFLOCK_H
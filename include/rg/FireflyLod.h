@@ -0,0 +1,189 @@
+#ifndef PROJECT_BASE_FIREFLYLOD_H
+#define PROJECT_BASE_FIREFLYLOD_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <rg/FireflySystem.h>
+#include <rg/JobSystem.h>
+#include <rg/ModelCollider.h>
+
+// Simulation level of detail for the random walk: fireflies near the camera are advanced every tick,
+// farther ones every 2nd or 4th tick and the ones beyond the last distance (the far plane) not at all.
+// A firefly remembers the tick it was advanced to and FireflySystem::advance takes it to the current
+// one in closed form, so a firefly that comes back into view continues as if it had been simulated
+// all along, and the cost of a tick follows the fireflies near the camera.
+// Every tier keeps a list of its fireflies. Tiers are reassigned incrementally, a slice of the
+// fireflies per tick, so a camera move costs nothing up front.
+class FireflyLod {
+public:
+    static const unsigned int Tiers = 4;
+    static const unsigned int Frozen = Tiers - 1;
+
+    struct Settings {
+        float distances[Tiers - 1] = {20.0f, 50.0f, 100.0f};   // upper bounds of the tiers that move
+        unsigned int reassignPerTick = 1024;
+    };
+
+    Settings settings;
+
+    // tier t < Frozen is advanced every period(t) ticks, all of them divide the retarget period
+    static unsigned int period(unsigned int tier) {
+        return 1u << tier;
+    }
+
+    // the fireflies are all current at `tick`, every one is put in its tier right away
+    void reset(const FireflySystem& fireflies, uint64_t tick, const glm::vec3& camera) {
+        unsigned int n = fireflies.size();
+        this->camera = camera;
+        tiers.assign(n, 0);
+        slots.resize(n);
+        lastTicks.assign(n, tick);
+        for (std::vector<unsigned int>& list: members)
+            list.clear();
+        for (unsigned int i = 0; i < n; i++) {
+            tiers[i] = tierOf(fireflies, i);
+            slots[i] = members[tiers[i]].size();
+            members[tiers[i]].push_back(i);
+        }
+        cursor = 0;
+    }
+
+    void setCamera(const glm::vec3& position) {
+        camera = position;
+    }
+
+    // fireflies currently in the tier
+    unsigned int count(unsigned int tier) const {
+        return members[tier].size();
+    }
+
+    // one simulation tick: reassigns the next slice of fireflies, then advances the tiers that are due
+    // to `tick` (after the retarget and integrate of that tick), colliding them on the way
+    void tick(FireflySystem& fireflies, JobSystem& jobs, unsigned int chunk, uint64_t tick, uint64_t retargetTicks,
+              float maxSpeed, float yLimit, const ModelCollider& collider) {
+        unsigned int n = fireflies.size();
+        for (unsigned int k = 0; k < std::min(settings.reassignPerTick, n); k++) {
+            move(cursor, tierOf(fireflies, cursor));
+            cursor = cursor + 1 < n ? cursor + 1 : 0;
+        }
+        for (unsigned int tier = 0; tier < Frozen; tier++) {
+            if (tick % period(tier) == 0)
+                advance(fireflies, jobs, chunk, members[tier], tick, retargetTicks, maxSpeed, yLimit, collider);
+        }
+    }
+
+    // brings firefly i to `tick` without colliding it, for code about to overwrite its position: the
+    // position is then the one at `tick` and advancing doesn't add the ticks it was behind on top of it
+    void touch(FireflySystem& fireflies, unsigned int i, uint64_t tick, uint64_t retargetTicks, float maxSpeed,
+               float yLimit) {
+        fireflies.advance(i, lastTicks[i], tick, retargetTicks, maxSpeed, yLimit);
+        lastTicks[i] = tick;
+    }
+
+    // brings every firefly, frozen ones too, to `tick`
+    void catchUp(FireflySystem& fireflies, JobSystem& jobs, unsigned int chunk, uint64_t tick, uint64_t retargetTicks,
+                 float maxSpeed, float yLimit, const ModelCollider& collider) {
+        for (unsigned int tier = 0; tier < Tiers; tier++)
+            advance(fireflies, jobs, chunk, members[tier], tick, retargetTicks, maxSpeed, yLimit, collider);
+    }
+
+private:
+    glm::vec3 camera = glm::vec3(0.0f);
+    std::vector<uint8_t> tiers;             // per firefly
+    std::vector<unsigned int> slots;        // per firefly, where it is in its tier's list
+    std::vector<uint64_t> lastTicks;        // per firefly, the tick its state belongs to
+    std::vector<unsigned int> members[Tiers];
+    unsigned int cursor = 0;                // next firefly to reassign
+
+    unsigned int tierOf(const FireflySystem& fireflies, unsigned int i) const {
+        glm::vec3 offset = fireflies.position(i) - camera;
+        float distance2 = glm::dot(offset, offset);
+        unsigned int tier = 0;
+        while (tier < Frozen && distance2 > settings.distances[tier] * settings.distances[tier])
+            tier++;
+        return tier;
+    }
+
+    // swap-with-last out of the old list
+    void move(unsigned int i, unsigned int tier) {
+        unsigned int old = tiers[i];
+        if (old == tier)
+            return;
+        std::vector<unsigned int>& from = members[old];
+        unsigned int last = from.back();
+        from[slots[i]] = last;
+        slots[last] = slots[i];
+        from.pop_back();
+        tiers[i] = tier;
+        slots[i] = members[tier].size();
+        members[tier].push_back(i);
+    }
+
+    void advance(FireflySystem& fireflies, JobSystem& jobs, unsigned int chunk, const std::vector<unsigned int>& list,
+                 uint64_t tick, uint64_t retargetTicks, float maxSpeed, float yLimit, const ModelCollider& collider) {
+        jobs.parallelFor(0, list.size(), chunk, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int k = begin; k < end; k++) {
+                unsigned int i = list[k];
+                if (lastTicks[i] == tick)
+                    continue;
+                glm::vec3 previous = fireflies.position(i);
+                fireflies.advance(i, lastTicks[i], tick, retargetTicks, maxSpeed, yLimit);
+                collider.collide(fireflies, i, previous, yLimit);
+                lastTicks[i] = tick;
+            }
+        });
+    }
+};
+
+// time per tick of the random walk of 50k fireflies spread over 200 x 200 through a synthetic forest,
+// all simulated every tick and with level of detail around a camera in the middle (--benchmark)
+inline void benchmarkFireflyLod(std::ostream& out, JobSystem& jobs, unsigned int grain) {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned int n = 50000, ticks = 360, trees = 300;
+    const uint64_t retargetTicks = 180;
+    const float extent = 100.0f, maxSpeed = 0.01f, yLimit = 5.0f;
+    TriangleBVH bvh;
+    buildBenchmarkForest(bvh, trees, extent, 7);
+    ModelCollider collider(&bvh, glm::vec3(0.0f, -yLimit, 0.0f), 1.0f);
+
+    for (bool lod: {false, true}) {
+        FireflySystem fireflies(n);
+        for (unsigned int i = 0; i < n; i++) {
+            uint32_t key = randomKey(fireflies.seed, i);
+            fireflies.setPosition(i, glm::vec3(randomSigned(randomBits(key, 0)) * extent,
+                                               randomSigned(randomBits(key, 1)) * yLimit,
+                                               randomSigned(randomBits(key, 2)) * extent));
+        }
+        FireflyLod levels;
+        levels.reset(fireflies, 0, glm::vec3(0.0f));
+
+        Clock::time_point start = Clock::now();
+        for (uint64_t tick = 1; tick <= ticks; tick++) {
+            if (lod) {
+                levels.tick(fireflies, jobs, grain, tick, retargetTicks, maxSpeed, yLimit, collider);
+            } else {
+                jobs.parallelFor(0, n, grain, [&fireflies, &collider, tick, retargetTicks, maxSpeed, yLimit](unsigned int begin, unsigned int end) {
+                    if (tick % retargetTicks == 0)
+                        fireflies.retarget(begin, end, tick / retargetTicks, maxSpeed, yLimit);
+                    fireflies.integrate(begin, end, yLimit);
+                    collider.collide(fireflies, begin, end, yLimit);
+                });
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        out << n << " fireflies colliding " << (lod ? "with" : "without") << " simulation LOD";
+        if (lod)
+            out << " (" << levels.count(0) << " / " << levels.count(1) << " / " << levels.count(2) << " / "
+                << levels.count(FireflyLod::Frozen) << " per tier)";
+        out << ", " << jobs.threadCount() << " thread(s): " << seconds / ticks * 1e3 << " ms/tick\n";
+    }
+}
+
+#endif //PROJECT_BASE_FIREFLYLOD_H
@@ -0,0 +1,49 @@
+#ifndef PROJECT_BASE_FIREFLYMOTION_H
+#define PROJECT_BASE_FIREFLYMOTION_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#include <rg/Random.h>
+
+// CPU side of resources/shaders/firefly_motion.glsl: the position of a firefly as a function of
+// (seed, index, time), without any state. The shaders place the lights and the light cubes with it,
+// the CPU only evaluates it for the light assignments that cull on the CPU (clusters, the light
+// tree, per mesh lists). Both sides are integer math on the same fixed point grid, converted to
+// float exactly at the end, so they agree to the bit and culling never misses a light.
+// The constants have to match the shader.
+const uint32_t FIREFLY_SEGMENT_SHIFT = 12;       // 4096 ms between control points
+const uint32_t FIREFLY_STEP_SHIFT = 2;           // positions change every 4 ms, 1024 steps per segment
+const uint32_t FIREFLY_HOME_RANGE = 6553600;     // homes within [-50, 50) on x and z
+const int32_t FIREFLY_HOME_OFFSET = 3276800;
+const int32_t FIREFLY_FIXED_HALF = 131072;       // homes within [-2, 2) on y, control points within 2 of home
+
+// a control point in fixed point (1/65536 world units), within 2 of home on every axis
+inline glm::ivec3 fireflyControlPoint(uint32_t key, const glm::ivec3& home, uint32_t segment) {
+    uint32_t counter = 4 + 3 * segment;
+    return glm::ivec3(home.x + (int32_t) (randomBits(key, counter) >> 14) - FIREFLY_FIXED_HALF,
+                      home.y + (int32_t) (randomBits(key, counter + 1) >> 14) - FIREFLY_FIXED_HALF,
+                      home.z + (int32_t) (randomBits(key, counter + 2) >> 14) - FIREFLY_FIXED_HALF);
+}
+
+// `time` in milliseconds, wrapping around like the shader's int
+inline glm::vec3 fireflyMotion(uint32_t seed, uint32_t id, uint32_t time) {
+    uint32_t key = randomKey(seed, id);
+    glm::ivec3 home((int32_t) ((randomBits(key, 0) >> 8) % FIREFLY_HOME_RANGE) - FIREFLY_HOME_OFFSET,
+                    (int32_t) (randomBits(key, 1) >> 14) - FIREFLY_FIXED_HALF,
+                    (int32_t) ((randomBits(key, 2) >> 8) % FIREFLY_HOME_RANGE) - FIREFLY_HOME_OFFSET);
+    time += randomBits(key, 3) >> (32 - FIREFLY_SEGMENT_SHIFT);
+    uint32_t segment = time >> FIREFLY_SEGMENT_SHIFT;
+    glm::ivec3 from = fireflyControlPoint(key, home, segment);
+    glm::ivec3 to = fireflyControlPoint(key, home, segment + 1);
+
+    uint32_t f = (time >> FIREFLY_STEP_SHIFT) & 1023u;
+    int32_t s = (int32_t) ((f * f * (3072u - 2u * f)) >> 18);
+    // >> of a negative int is arithmetic with every compiler this builds with, like GLSL's
+    return glm::vec3((float) (from.x + (((to.x - from.x) * s) >> 12)),
+                     (float) (from.y + (((to.y - from.y) * s) >> 12)),
+                     (float) (from.z + (((to.z - from.z) * s) >> 12))) * (1.0f / 65536.0f);
+}
+
+#endif //PROJECT_BASE_FIREFLYMOTION_H
@@ -0,0 +1,256 @@
+#ifndef PROJECT_BASE_FIREFLYSIMULATION_H
+#define PROJECT_BASE_FIREFLYSIMULATION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <rg/FireflyFlock.h>
+#include <rg/FireflyLod.h>
+#include <rg/FireflySystem.h>
+#include <rg/JobSystem.h>
+#include <rg/ModelCollider.h>
+#include <rg/SimulationClock.h>
+#include <rg/TripleBuffer.h>
+
+// the state of the fireflies after a simulation tick, as published to the render thread
+struct FireflySnapshot {
+    FireflySystem fireflies;
+    uint64_t tick = 0;      // the tick the state belongs to
+    double time = 0.0;      // when that tick was due, on SimulationClock::now()
+    // fireflies per FireflyLod tier, all in the first one without level of detail
+    unsigned int tierCounts[FireflyLod::Tiers] = {};
+
+    explicit FireflySnapshot(const FireflySystem& fireflies) : fireflies(fireflies) {
+    }
+
+    // how far the render time `now` is past this tick, in ticks of the given length, for
+    // FireflySystem::position(i, alpha, yLimit)
+    float alpha(double now, double tickSeconds) const {
+        return (float) std::min(std::max((now - time) / tickSeconds, 0.0), 1.0);
+    }
+};
+
+// Runs the CPU firefly simulation on its own thread at the fixed tick rate, so its cost doesn't add
+// to the frame time. After every batch of ticks the state is published through a TripleBuffer and
+// the render thread picks up the newest complete snapshot without ever waiting.
+// The ticks are spread over the job system, which is only used from this thread while it runs.
+// With flocking every tick needs the previous one finished for all fireflies (FireflyFlock), without
+// it every chunk runs all due ticks on its own. After every step the fireflies are collided with the
+// forest (ModelCollider), when one is set.
+// The random walk can run with level of detail around the camera (FireflyLod), fireflies far away are
+// then advanced less often. The published state is not current for those, which is fine as long as
+// the tiers are chosen so they aren't visible; stop() brings all fireflies to the last tick.
+class FireflySimulation {
+public:
+    struct Settings {
+        double tickRate;
+        float maxSpeed;             // see FireflySystem::retarget
+        float yLimit;
+        uint64_t retargetTicks;     // ticks between changes of direction
+        unsigned int chunk;         // fireflies per job
+        bool flocking;              // swarm instead of the independent random walk
+    };
+
+    FireflySimulation(const FireflySystem& fireflies, JobSystem& jobs, const Settings& settings)
+            : fireflies(fireflies), jobs(jobs), settings(settings), snapshots(FireflySnapshot(fireflies)) {
+    }
+
+    ~FireflySimulation() {
+        stop();
+    }
+
+    FireflySimulation(const FireflySimulation&) = delete;
+    FireflySimulation& operator=(const FireflySimulation&) = delete;
+
+    // starts (or continues) the simulation at the given tick
+    void start(uint64_t tick) {
+        if (thread.joinable())
+            return;
+        clock = SimulationClock(settings.tickRate);
+        clock.tick = tick;
+        // the render thread sees the current state right away, not the last one published before stopping
+        FireflySnapshot& snapshot = snapshots.back();
+        snapshot.fireflies = fireflies;
+        snapshot.tick = tick;
+        snapshot.time = SimulationClock::now() - 1.0 / settings.tickRate;
+        snapshots.publish();
+        running = true;
+        thread = std::thread(&FireflySimulation::run, this);
+    }
+
+    // waits for the thread to finish its tick and returns the last tick it ran. While stopped the
+    // state can be used directly (e.g. handed to the GPU simulation).
+    uint64_t stop() {
+        if (thread.joinable()) {
+            running = false;
+            thread.join();
+            applyEdits();
+            catchUp(clock.tick);
+        }
+        return clock.tick;
+    }
+
+    // only while stopped
+    FireflySystem& state() {
+        return fireflies;
+    }
+
+    // render thread: the newest published snapshot
+    const FireflySnapshot& latest() {
+        snapshots.update();
+        return snapshots.front();
+    }
+
+    // any thread: moves a firefly before the next tick
+    void setPosition(unsigned int i, const glm::vec3& position) {
+        std::lock_guard<std::mutex> lock(editsMutex);
+        edits.emplace_back(i, position);
+    }
+
+    // any thread: switches flocking and its settings before the next tick
+    void setFlocking(bool enabled, const FireflyFlock::Settings& flockSettings) {
+        std::lock_guard<std::mutex> lock(editsMutex);
+        flockingEdit = enabled;
+        flockEdit = flockSettings;
+        flockEdited = true;
+    }
+
+    // any thread: the geometry the fireflies bounce off from the next tick on, a collider without a
+    // hierarchy turns collisions off. The hierarchy has to outlive the simulation.
+    void setCollider(const ModelCollider& newCollider) {
+        std::lock_guard<std::mutex> lock(editsMutex);
+        colliderEdit = newCollider;
+        colliderEdited = true;
+    }
+
+    // any thread: switches the level of detail of the random walk and moves its centre, before the next
+    // tick. Flocking always runs at the full rate, a swarm needs all its neighbours at the same tick.
+    void setLod(bool enabled, const glm::vec3& camera) {
+        std::lock_guard<std::mutex> lock(editsMutex);
+        lodEdit = enabled;
+        cameraEdit = camera;
+    }
+
+private:
+    FireflySystem fireflies;
+    JobSystem& jobs;
+    Settings settings;
+    SimulationClock clock{60.0};
+    TripleBuffer<FireflySnapshot> snapshots;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::mutex editsMutex;
+    std::vector<std::pair<unsigned int, glm::vec3>> edits;
+    bool flockEdited = false;
+    bool flockingEdit = false;
+    FireflyFlock::Settings flockEdit;
+    FireflyFlock flock;
+    bool colliderEdited = false;
+    ModelCollider colliderEdit;
+    ModelCollider collider;
+    bool lodEdit = false;
+    glm::vec3 cameraEdit = glm::vec3(0.0f);
+    FireflyLod lod;
+    bool lodEnabled = false;
+    glm::vec3 camera = glm::vec3(0.0f);
+    bool lodActive = false;     // the fireflies are at the ticks lod keeps, not all at clock.tick
+
+    void applyEdits() {
+        std::lock_guard<std::mutex> lock(editsMutex);
+        for (const std::pair<unsigned int, glm::vec3>& edit: edits) {
+            // a firefly LOD left behind would otherwise be advanced from the edited position
+            if (lodActive)
+                lod.touch(fireflies, edit.first, clock.tick, settings.retargetTicks, settings.maxSpeed, settings.yLimit);
+            fireflies.setPosition(edit.first, edit.second);
+        }
+        edits.clear();
+        if (flockEdited) {
+            settings.flocking = flockingEdit;
+            flock.setSettings(flockEdit);
+            flockEdited = false;
+        }
+        if (colliderEdited) {
+            collider = colliderEdit;
+            colliderEdited = false;
+        }
+        lodEnabled = lodEdit;
+        camera = cameraEdit;
+        lod.setCamera(camera);
+    }
+
+    // brings the fireflies LOD left behind to `tick`, the one all others are at
+    void catchUp(uint64_t tick) {
+        if (!lodActive)
+            return;
+        const Settings& s = settings;
+        lod.catchUp(fireflies, jobs, s.chunk, tick, s.retargetTicks, s.maxSpeed, s.yLimit, collider);
+        lodActive = false;
+    }
+
+    void run() {
+        while (running.load(std::memory_order_relaxed)) {
+            applyEdits();
+            unsigned int ticks = clock.advance(SimulationClock::now());
+            if (ticks > 0) {
+                // every retargetTicks the fireflies change direction (change number n is the firefly random
+                // streams' tick n)
+                uint64_t firstTick = clock.tick - ticks + 1, lastTick = clock.tick;
+                const Settings& s = settings;
+                FireflySystem& f = fireflies;
+                const ModelCollider& c = collider;
+                if (!s.flocking && lodEnabled) {
+                    if (!lodActive) {
+                        lod.reset(f, firstTick - 1, camera);
+                        lodActive = true;
+                    }
+                    for (uint64_t tick = firstTick; tick <= lastTick; tick++)
+                        lod.tick(f, jobs, s.chunk, tick, s.retargetTicks, s.maxSpeed, s.yLimit, c);
+                } else if (s.flocking) {
+                    catchUp(firstTick - 1);
+                    for (uint64_t tick = firstTick; tick <= lastTick; tick++) {
+                        flock.tick(f, jobs, s.chunk, tick, s.retargetTicks, s.maxSpeed, s.yLimit);
+                        if (c.bvh) {
+                            jobs.parallelFor(0, f.size(), s.chunk, [&f, &s, &c](unsigned int begin, unsigned int end) {
+                                c.collide(f, begin, end, s.yLimit);
+                            });
+                        }
+                    }
+                } else {
+                    catchUp(firstTick - 1);
+                    // every chunk runs all ticks that are due
+                    jobs.parallelFor(0, f.size(), s.chunk, [&f, &s, &c, firstTick, lastTick](unsigned int begin, unsigned int end) {
+                        for (uint64_t tick = firstTick; tick <= lastTick; tick++) {
+                            if (tick % s.retargetTicks == 0)
+                                f.retarget(begin, end, tick / s.retargetTicks, s.maxSpeed, s.yLimit);
+                            f.integrate(begin, end, s.yLimit);
+                            c.collide(f, begin, end, s.yLimit);
+                        }
+                    });
+                }
+
+                // the buffers of the back snapshot are reused, copying doesn't allocate
+                FireflySnapshot& snapshot = snapshots.back();
+                snapshot.fireflies = fireflies;
+                snapshot.tick = clock.tick;
+                snapshot.time = clock.lastTickTime();
+                for (unsigned int tier = 0; tier < FireflyLod::Tiers; tier++)
+                    snapshot.tierCounts[tier] = lodActive ? lod.count(tier) : (tier == 0 ? f.size() : 0);
+                snapshots.publish();
+            }
+            // sleep until the next tick is due
+            double wait = (1.0 - clock.alpha()) * clock.tickSeconds();
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::max(wait, 0.0)));
+        }
+    }
+};
+
+#endif //PROJECT_BASE_FIREFLYSIMULATION_H
@@ -0,0 +1,322 @@
+#ifndef PROJECT_BASE_FIREFLYSYSTEM_H
+#define PROJECT_BASE_FIREFLYSYSTEM_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <vector>
+
+#include <rg/JobSystem.h>
+#include <rg/Random.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIREFLY_SIMD
+#include <immintrin.h>
+#endif
+
+// Firefly movement state as a structure of arrays, so the per-frame update streams through
+// contiguous floats. The update kernels come in a scalar, an SSE2 and an AVX2 flavour, the best one
+// the CPU supports is picked at runtime (the binary itself is built for the baseline instruction set).
+// All kernels produce the same results: velocities come from the counter-based generator in
+// Random.h (stream: firefly index, counter: retarget tick), and the SIMD kernels run the same float
+// operations in the same order.
+class FireflySystem {
+public:
+    enum Kernel {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    // positions and per-frame velocities
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+
+    Kernel kernel = bestKernel();
+
+    // every run with the same seed moves the fireflies the same way
+    uint32_t seed;
+
+    explicit FireflySystem(unsigned int count, uint32_t seed = 1)
+            : px(count), py(count), pz(count), vx(count), vy(count), vz(count), seed(seed) {
+    }
+
+    unsigned int size() const {
+        return px.size();
+    }
+
+    glm::vec3 position(unsigned int i) const {
+        return glm::vec3(px[i], py[i], pz[i]);
+    }
+
+    // position between the last two integrate steps, alpha 0 is the previous one and 1 the current one.
+    // The last step moved the firefly by its velocity, except where the height was clamped, which is
+    // clamped again here.
+    glm::vec3 position(unsigned int i, float alpha, float yLimit) const {
+        float back = 1.0f - alpha;
+        return glm::vec3(px[i] - back * vx[i], std::min(std::max(py[i] - back * vy[i], -yLimit), yLimit),
+                         pz[i] - back * vz[i]);
+    }
+
+    void setPosition(unsigned int i, const glm::vec3& position) {
+        px[i] = position.x;
+        py[i] = position.y;
+        pz[i] = position.z;
+    }
+
+    // The live fireflies are always [0, size()), so the kernels and uploads never skip holes.
+    // grows the pool with fireflies at rest at the origin (to be placed with setPosition), or shrinks
+    // it by dropping the last ones
+    void resize(unsigned int count) {
+        for (std::vector<float>* v: {&px, &py, &pz, &vx, &vy, &vz})
+            v->resize(count, 0.0f);
+    }
+
+    // adds a firefly at rest, returns its index
+    unsigned int spawn(const glm::vec3& position) {
+        unsigned int i = size();
+        resize(i + 1);
+        setPosition(i, position);
+        return i;
+    }
+
+    // removes firefly i, the last firefly moves into its slot (and from then on draws the random
+    // velocities of slot i). Whoever keeps data per firefly does the same.
+    void despawn(unsigned int i) {
+        unsigned int last = size() - 1;
+        for (std::vector<float>* v: {&px, &py, &pz, &vx, &vy, &vz}) {
+            (*v)[i] = (*v)[last];
+            v->pop_back();
+        }
+    }
+
+    // moves every firefly by its velocity and keeps it within [-yLimit, yLimit] vertically
+    void integrate(float yLimit) {
+        integrate(0, size(), yLimit);
+    }
+
+    // same for the fireflies in [begin, end), ranges that don't overlap can be updated concurrently
+    void integrate(unsigned int begin, unsigned int end, float yLimit) {
+        unsigned int i = begin;
+#ifdef FIREFLY_SIMD
+        if (kernel == AVX2)
+            i = integrateAVX2(begin, end, yLimit);
+        else if (kernel == SSE2)
+            i = integrateSSE2(begin, end, yLimit);
+#endif
+        for (; i < end; i++) {
+            px[i] += vx[i];
+            py[i] = std::min(std::max(py[i] + vy[i], -yLimit), yLimit);
+            pz[i] += vz[i];
+        }
+    }
+
+    // draws new velocities in [-maxSpeed, maxSpeed). The vertical one is dropped where it would take
+    // the firefly out of (-yLimit, yLimit) within one step.
+    // Retarget number `tick` (counted from 1, see counter()) draws the same velocities however often it
+    // is repeated and whichever thread runs it.
+    void retarget(uint32_t tick, float maxSpeed, float yLimit) {
+        retarget(0, size(), tick, maxSpeed, yLimit);
+    }
+
+    // same for the fireflies in [begin, end), ranges that don't overlap can be updated concurrently
+    void retarget(unsigned int begin, unsigned int end, uint32_t tick, float maxSpeed, float yLimit) {
+        unsigned int i = begin;
+#ifdef FIREFLY_SIMD
+        if (kernel == AVX2)
+            i = retargetAVX2(begin, end, tick, maxSpeed, yLimit);
+        else if (kernel == SSE2)
+            i = retargetSSE2(begin, end, tick, maxSpeed, yLimit);
+#endif
+        for (; i < end; i++)
+            retargetOne(i, tick, maxSpeed, yLimit);
+    }
+
+    // moves firefly i from simulation tick `from` to tick `to` the way integrate and retarget would have
+    // (retarget number n before the integrate of tick n * retargetTicks), up to rounding. Between two
+    // retargets the velocity doesn't change, so a whole stretch is one step: the cost is the number of
+    // retargets passed, not the number of ticks. For fireflies that are simulated at a lower rate or not
+    // at all for a while (FireflyLod).
+    void advance(unsigned int i, uint64_t from, uint64_t to, uint64_t retargetTicks, float maxSpeed, float yLimit) {
+        uint64_t tick = from;
+        uint64_t retargetTick = (from / retargetTicks + 1) * retargetTicks;
+        while (tick < to) {
+            // ticks up to the one before the next retarget keep the velocity
+            uint64_t last = std::min(retargetTick - 1, to);
+            if (last > tick) {
+                float steps = (float) (last - tick);
+                px[i] += steps * vx[i];
+                py[i] = std::min(std::max(py[i] + steps * vy[i], -yLimit), yLimit);
+                pz[i] += steps * vz[i];
+                tick = last;
+            }
+            if (tick < to) {
+                retargetOne(i, (uint32_t) (retargetTick / retargetTicks), maxSpeed, yLimit);
+                px[i] += vx[i];
+                py[i] = std::min(std::max(py[i] + vy[i], -yLimit), yLimit);
+                pz[i] += vz[i];
+                tick = retargetTick;
+                retargetTick += retargetTicks;
+            }
+        }
+    }
+
+    // counter of a firefly's random stream for the given axis of the given tick. Tick 0 is the spawn,
+    // retargeting starts at tick 1.
+    static uint32_t counter(uint32_t tick, uint32_t axis) {
+        return 3 * tick + axis;
+    }
+
+    static bool supported(Kernel kernel) {
+#ifdef FIREFLY_SIMD
+        if (kernel == AVX2)
+            return __builtin_cpu_supports("avx2");
+        if (kernel == SSE2)
+            return __builtin_cpu_supports("sse2");
+#endif
+        return kernel == Scalar;
+    }
+
+    static Kernel bestKernel() {
+        return supported(AVX2) ? AVX2 : supported(SSE2) ? SSE2 : Scalar;
+    }
+
+    static const char* kernelName(Kernel kernel) {
+        return kernel == AVX2 ? "AVX2" : kernel == SSE2 ? "SSE2" : "scalar";
+    }
+
+private:
+    void retargetOne(unsigned int i, uint32_t tick, float maxSpeed, float yLimit) {
+        uint32_t key = randomKey(seed, i);
+        vx[i] = randomSigned(randomBits(key, counter(tick, 0))) * maxSpeed;
+        float y = randomSigned(randomBits(key, counter(tick, 1))) * maxSpeed;
+        vy[i] = (py[i] + y > -yLimit && py[i] + y < yLimit) ? y : 0.0f;
+        vz[i] = randomSigned(randomBits(key, counter(tick, 2))) * maxSpeed;
+    }
+
+#ifdef FIREFLY_SIMD
+    // the SIMD kernels process whole vectors and return where the scalar loop has to continue
+
+    // randomSigned scaled by maxSpeed
+    __attribute__((target("sse2")))
+    static __m128 velocitySSE2(__m128i bits, __m128 maxSpeed) {
+        __m128 unit = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(bits, 8)), _mm_set1_ps(2.0f / 16777216.0f));
+        return _mm_mul_ps(_mm_sub_ps(unit, _mm_set1_ps(1.0f)), maxSpeed);
+    }
+
+    __attribute__((target("sse2")))
+    unsigned int integrateSSE2(unsigned int begin, unsigned int end, float yLimit) {
+        const __m128 hi = _mm_set1_ps(yLimit), lo = _mm_set1_ps(-yLimit);
+        unsigned int i = begin;
+        for (; i + 4 <= end; i += 4) {
+            _mm_storeu_ps(&px[i], _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_loadu_ps(&vx[i])));
+            __m128 y = _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_loadu_ps(&vy[i]));
+            _mm_storeu_ps(&py[i], _mm_min_ps(_mm_max_ps(y, lo), hi));
+            _mm_storeu_ps(&pz[i], _mm_add_ps(_mm_loadu_ps(&pz[i]), _mm_loadu_ps(&vz[i])));
+        }
+        return i;
+    }
+
+    __attribute__((target("sse2")))
+    unsigned int retargetSSE2(unsigned int begin, unsigned int end, uint32_t tick, float maxSpeed, float yLimit) {
+        const __m128 speed = _mm_set1_ps(maxSpeed);
+        const __m128 hi = _mm_set1_ps(yLimit), lo = _mm_set1_ps(-yLimit);
+        unsigned int i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128i keys = randomKeySSE2(seed, _mm_add_epi32(_mm_set1_epi32((int) i), _mm_setr_epi32(0, 1, 2, 3)));
+            _mm_storeu_ps(&vx[i], velocitySSE2(randomBitsSSE2(keys, counter(tick, 0)), speed));
+            __m128 y = velocitySSE2(randomBitsSSE2(keys, counter(tick, 1)), speed);
+            __m128 next = _mm_add_ps(_mm_loadu_ps(&py[i]), y);
+            __m128 inside = _mm_and_ps(_mm_cmpgt_ps(next, lo), _mm_cmplt_ps(next, hi));
+            _mm_storeu_ps(&vy[i], _mm_and_ps(inside, y));
+            _mm_storeu_ps(&vz[i], velocitySSE2(randomBitsSSE2(keys, counter(tick, 2)), speed));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    static __m256 velocityAVX2(__m256i bits, __m256 maxSpeed) {
+        __m256 unit = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)), _mm256_set1_ps(2.0f / 16777216.0f));
+        return _mm256_mul_ps(_mm256_sub_ps(unit, _mm256_set1_ps(1.0f)), maxSpeed);
+    }
+
+    __attribute__((target("avx2")))
+    unsigned int integrateAVX2(unsigned int begin, unsigned int end, float yLimit) {
+        const __m256 hi = _mm256_set1_ps(yLimit), lo = _mm256_set1_ps(-yLimit);
+        unsigned int i = begin;
+        for (; i + 8 <= end; i += 8) {
+            _mm256_storeu_ps(&px[i], _mm256_add_ps(_mm256_loadu_ps(&px[i]), _mm256_loadu_ps(&vx[i])));
+            __m256 y = _mm256_add_ps(_mm256_loadu_ps(&py[i]), _mm256_loadu_ps(&vy[i]));
+            _mm256_storeu_ps(&py[i], _mm256_min_ps(_mm256_max_ps(y, lo), hi));
+            _mm256_storeu_ps(&pz[i], _mm256_add_ps(_mm256_loadu_ps(&pz[i]), _mm256_loadu_ps(&vz[i])));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    unsigned int retargetAVX2(unsigned int begin, unsigned int end, uint32_t tick, float maxSpeed, float yLimit) {
+        const __m256 speed = _mm256_set1_ps(maxSpeed);
+        const __m256 hi = _mm256_set1_ps(yLimit), lo = _mm256_set1_ps(-yLimit);
+        unsigned int i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256i keys = randomKeyAVX2(seed, _mm256_add_epi32(_mm256_set1_epi32((int) i),
+                                                                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+            _mm256_storeu_ps(&vx[i], velocityAVX2(randomBitsAVX2(keys, counter(tick, 0)), speed));
+            __m256 y = velocityAVX2(randomBitsAVX2(keys, counter(tick, 1)), speed);
+            __m256 next = _mm256_add_ps(_mm256_loadu_ps(&py[i]), y);
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(next, lo, _CMP_GT_OQ), _mm256_cmp_ps(next, hi, _CMP_LT_OQ));
+            _mm256_storeu_ps(&vy[i], _mm256_and_ps(inside, y));
+            _mm256_storeu_ps(&vz[i], velocityAVX2(randomBitsAVX2(keys, counter(tick, 2)), speed));
+        }
+        return i;
+    }
+#endif
+};
+
+// throughput of every kernel the CPU supports at 1k, 100k and 1M fireflies, and of the best one
+// spread over the job system in chunks of `grain` fireflies (--benchmark)
+inline void benchmarkFireflySystem(std::ostream& out, JobSystem& jobs, unsigned int grain) {
+    typedef std::chrono::steady_clock Clock;
+    for (unsigned int n: {1000u, 100000u, 1000000u}) {
+        // about the same amount of work for every size
+        unsigned int steps = std::max(10u, 200000000u / n);
+        for (unsigned int run = 0; run < 4; run++) {
+            // the three kernels on one thread, then the best one on all threads
+            FireflySystem::Kernel kernel = run < 3 ? (FireflySystem::Kernel) run : FireflySystem::bestKernel();
+            unsigned int threads = run < 3 ? 1 : jobs.threadCount();
+            if (!FireflySystem::supported(kernel) || (run == 3 && threads == 1))
+                continue;
+            FireflySystem fireflies(n);
+            fireflies.kernel = kernel;
+            fireflies.retarget(1, 0.01f, 5.0f);
+            unsigned int chunk = threads == 1 ? n : grain;
+
+            Clock::time_point start = Clock::now();
+            for (unsigned int step = 0; step < steps; step++) {
+                jobs.parallelFor(0, n, chunk, [&fireflies](unsigned int begin, unsigned int end) {
+                    fireflies.integrate(begin, end, 5.0f);
+                });
+            }
+            double integrateSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            start = Clock::now();
+            for (unsigned int step = 0; step < steps / 4; step++) {
+                jobs.parallelFor(0, n, chunk, [&fireflies, step](unsigned int begin, unsigned int end) {
+                    fireflies.retarget(begin, end, step + 1, 0.01f, 5.0f);
+                });
+            }
+            double retargetSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            out << n << " fireflies, " << FireflySystem::kernelName(kernel) << ", " << threads << " thread(s): "
+                << "integrate " << (double) n * steps / integrateSeconds * 1e-6 << " M/s, "
+                << "retarget " << (double) n * (steps / 4) / retargetSeconds * 1e-6 << " M/s"
+                << " (checksum " << fireflies.px[n / 2] + fireflies.py[n / 3] + fireflies.pz[n - 1] << ")\n";
+        }
+    }
+}
+
+#endif //PROJECT_BASE_FIREFLYSYSTEM_H
@@ -0,0 +1,178 @@
+#ifndef PROJECT_BASE_GLSTATECACHE_H
+#define PROJECT_BASE_GLSTATECACHE_H
+
+#include <glad/glad.h>
+
+// Remembers the GL state the frame keeps switching (program, vertex array, the textures bound to
+// every unit, blending, depth test and cull state) and drops calls that wouldn't change any of it.
+// Only works if nothing else touches that state, so all rendering code binds through glState().
+// ImGui's backend saves and restores everything it changes and can be left alone. Until a piece of
+// state has been set through the cache it is unknown and the first call always goes through.
+// Texture bindings are per unit and target, bindTexture() switches the active unit only when needed.
+class GLStateCache {
+public:
+    static const unsigned int MaxUnits = 32;
+
+    // calls made to GL and calls dropped as redundant, since the last resetCounters()
+    struct Counters {
+        unsigned int issued = 0;
+        unsigned int filtered = 0;
+    };
+
+    const Counters& counters() const {
+        return count;
+    }
+
+    void resetCounters() {
+        count = Counters();
+    }
+
+    // forgets everything, for code that changed GL state behind the cache's back
+    void invalidate() {
+        *this = GLStateCache();
+    }
+
+    void useProgram(unsigned int id) {
+        if (changed(program, id))
+            glUseProgram(id);
+    }
+
+    void bindVertexArray(unsigned int id) {
+        if (changed(vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // unit is the index, not GL_TEXTURE0 + index
+    void activeTexture(unsigned int unit) {
+        if (changed(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds the texture to the unit and leaves the unit active, e.g. for drawing or to fill it.
+    // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_BUFFER are tracked.
+    void bindTexture(unsigned int unit, GLenum target, unsigned int id) {
+        activeTexture(unit);
+        unsigned int index = targetIndex(target);
+        if (index < Targets) {
+            if (textures[unit][index] == id) {
+                count.filtered++;
+                return;
+            }
+            textures[unit][index] = id;
+        }
+        count.issued++;
+        glBindTexture(target, id);
+    }
+
+    // GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are tracked, other capabilities go straight to GL
+    void enable(GLenum capability) {
+        set(capability, true);
+    }
+
+    void disable(GLenum capability) {
+        set(capability, false);
+    }
+
+    void blendFunc(GLenum source, GLenum destination) {
+        if (blendSource == source && blendDestination == destination) {
+            count.filtered++;
+            return;
+        }
+        blendSource = source;
+        blendDestination = destination;
+        count.issued++;
+        glBlendFunc(source, destination);
+    }
+
+    void depthFunc(GLenum function) {
+        if (changed(depthFunction, function))
+            glDepthFunc(function);
+    }
+
+    void depthMask(bool write) {
+        if (changed(depthWrite, (unsigned int) write))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void cullFace(GLenum face) {
+        if (changed(culledFace, face))
+            glCullFace(face);
+    }
+
+private:
+    static const unsigned int Unknown = ~0u;
+    static const unsigned int Targets = 3;
+    static const unsigned int Capabilities = 3;
+
+    Counters count;
+    unsigned int program = Unknown;
+    unsigned int vertexArray = Unknown;
+    unsigned int activeUnit = Unknown;
+    unsigned int textures[MaxUnits][Targets] = {};
+    unsigned int capabilities[Capabilities] = {Unknown, Unknown, Unknown};
+    unsigned int blendSource = Unknown;
+    unsigned int blendDestination = Unknown;
+    unsigned int depthFunction = Unknown;
+    unsigned int depthWrite = Unknown;
+    unsigned int culledFace = Unknown;
+
+    GLStateCache() {
+        for (unsigned int unit = 0; unit < MaxUnits; unit++) {
+            for (unsigned int target = 0; target < Targets; target++)
+                textures[unit][target] = Unknown;
+        }
+    }
+
+    friend GLStateCache& glState();
+
+    // stores the value and counts the call, true if GL has to be told
+    bool changed(unsigned int& current, unsigned int value) {
+        if (current == value) {
+            count.filtered++;
+            return false;
+        }
+        current = value;
+        count.issued++;
+        return true;
+    }
+
+    // Targets for the ones that aren't tracked
+    static unsigned int targetIndex(GLenum target) {
+        switch (target) {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_CUBE_MAP: return 1;
+            case GL_TEXTURE_BUFFER: return 2;
+            default: return Targets;
+        }
+    }
+
+    // Capabilities for the ones that aren't tracked
+    static unsigned int capabilityIndex(GLenum capability) {
+        switch (capability) {
+            case GL_BLEND: return 0;
+            case GL_DEPTH_TEST: return 1;
+            case GL_CULL_FACE: return 2;
+            default: return Capabilities;
+        }
+    }
+
+    void set(GLenum capability, bool enabled) {
+        unsigned int i = capabilityIndex(capability);
+        if (i < Capabilities && !changed(capabilities[i], (unsigned int) enabled))
+            return;
+        if (i == Capabilities)
+            count.issued++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+};
+
+// the cache of the one GL context
+inline GLStateCache& glState() {
+    static GLStateCache cache;
+    return cache;
+}
+
+#endif //PROJECT_BASE_GLSTATECACHE_H
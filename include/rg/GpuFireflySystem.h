@@ -0,0 +1,139 @@
+#ifndef PROJECT_BASE_GPUFIREFLYSYSTEM_H
+#define PROJECT_BASE_GPUFIREFLYSYSTEM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <rg/FireflySystem.h>
+#include <rg/GLStateCache.h>
+
+// The firefly movement of FireflySystem run on the GPU with transform feedback (firefly_update.vs).
+// The state lives in two sets of buffers used ping-pong: a step reads one set as vertex attributes
+// and captures the moved fireflies into the other one, nothing goes through the CPU.
+// Every set has one buffer per captured varying (GL_SEPARATE_ATTRIBS):
+//  - positions: vec4 (xyz, 1), laid out like PointLightBuffer's positions, so the lighting shaders
+//    read it directly as their pointLightPositions texture buffer
+//  - velocities: vec3
+// New velocities come from the same counter-based generator as on the CPU, keyed by the firefly's
+// index (gl_VertexID) and the retarget tick, so there is no random state to keep.
+// The buffers hold up to `capacity` fireflies, the pool can change size up to that with every upload.
+class GpuFireflySystem {
+public:
+    // outputs of firefly_update.vs, in the order of the buffers they are captured into
+    static std::vector<const char*> feedbackVaryings() {
+        return { "outPosition", "outVelocity" };
+    }
+
+    explicit GpuFireflySystem(unsigned int capacity) : capacity(capacity) {
+        glGenBuffers(4, &buffers[0][0]);
+        glGenVertexArrays(2, vertexArrays);
+        glGenTextures(2, positionTextures);
+        for (unsigned int set = 0; set < 2; set++) {
+            glState().bindVertexArray(vertexArrays[set]);
+            for (unsigned int stream = 0; stream < 2; stream++) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[set][stream]);
+                glBufferData(GL_ARRAY_BUFFER, std::max(capacity, 1u) * streamSize(stream), nullptr, GL_DYNAMIC_COPY);
+                glEnableVertexAttribArray(stream);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[set][Positions]);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, streamSize(Positions), (void*)0);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[set][Velocities]);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, streamSize(Velocities), (void*)0);
+
+            glState().bindTexture(0, GL_TEXTURE_BUFFER, positionTextures[set]);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[set][Positions]);
+        }
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glState().bindVertexArray(0);
+    }
+
+    ~GpuFireflySystem() {
+        glDeleteTextures(2, positionTextures);
+        glDeleteVertexArrays(2, vertexArrays);
+        glDeleteBuffers(4, &buffers[0][0]);
+    }
+
+    GpuFireflySystem(const GpuFireflySystem&) = delete;
+    GpuFireflySystem& operator=(const GpuFireflySystem&) = delete;
+
+    // continues the simulation from the state of the CPU one, with as many fireflies (up to the capacity)
+    void upload(const FireflySystem& fireflies) {
+        count = std::min(fireflies.size(), capacity);
+        std::vector<glm::vec4> positions(count);
+        std::vector<glm::vec3> velocities(count);
+        for (unsigned int i = 0; i < count; i++) {
+            positions[i] = glm::vec4(fireflies.position(i), 1.0f);
+            velocities[i] = glm::vec3(fireflies.vx[i], fireflies.vy[i], fireflies.vz[i]);
+        }
+        const void* data[2] = { positions.data(), velocities.data() };
+        for (unsigned int stream = 0; stream < 2; stream++) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[current][stream]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * streamSize(stream), data[stream]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // hands the current state back to the CPU simulation, this waits for the GPU to finish the last step
+    void download(FireflySystem& fireflies) const {
+        fireflies.resize(count);
+        std::vector<glm::vec4> positions(count);
+        std::vector<glm::vec3> velocities(count);
+        void* data[2] = { positions.data(), velocities.data() };
+        for (unsigned int stream = 0; stream < 2; stream++) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[current][stream]);
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * streamSize(stream), data[stream]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for (unsigned int i = 0; i < count; i++) {
+            fireflies.setPosition(i, glm::vec3(positions[i]));
+            fireflies.vx[i] = velocities[i].x;
+            fireflies.vy[i] = velocities[i].y;
+            fireflies.vz[i] = velocities[i].z;
+        }
+    }
+
+    // advances every firefly by one frame, the update shader has to be in use with its uniforms set
+    void step() {
+        unsigned int next = 1 - current;
+        for (unsigned int stream = 0; stream < 2; stream++)
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, stream, buffers[next][stream]);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glState().bindVertexArray(vertexArrays[current]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        for (unsigned int stream = 0; stream < 2; stream++)
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, stream, 0);
+        current = next;
+    }
+
+    // binds the current positions in place of PointLightBuffer's
+    void bindPositions(unsigned int unit) const {
+        glState().bindTexture(unit, GL_TEXTURE_BUFFER, positionTextures[current]);
+    }
+
+private:
+    enum Stream {
+        Positions,
+        Velocities
+    };
+
+    unsigned int capacity;
+    unsigned int count = 0;
+    unsigned int buffers[2][2];
+    unsigned int vertexArrays[2];
+    unsigned int positionTextures[2];
+    unsigned int current = 0;
+
+    // bytes per firefly
+    static GLsizeiptr streamSize(unsigned int stream) {
+        return stream == Positions ? sizeof(glm::vec4) : sizeof(glm::vec3);
+    }
+};
+
+#endif //PROJECT_BASE_GPUFIREFLYSYSTEM_H
@@ -0,0 +1,165 @@
+#ifndef PROJECT_BASE_JOBSYSTEM_H
+#define PROJECT_BASE_JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool. Every thread owns a deque of jobs: it takes work from the back
+// of its own deque and, when that is empty, steals from the front of the others'. parallelFor splits
+// an index range into chunks and deals them out in consecutive blocks, one block per deque (the
+// caller's included), so every thread starts on its own part of the range and only steals once it is
+// through with it.
+// parallelFor is meant to be called from one thread at a time (the firefly simulation thread).
+class JobSystem {
+public:
+    // the caller of parallelFor is a thread of the pool too, so it gets one worker less than the cores
+    static unsigned int defaultWorkerCount() {
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
+
+    explicit JobSystem(unsigned int workerCount = defaultWorkerCount()) {
+        for (unsigned int i = 0; i <= workerCount; i++)
+            queues.emplace_back(new Queue());
+        for (unsigned int i = 1; i <= workerCount; i++)
+            workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker: workers)
+            worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // threads working on a parallelFor, including the caller
+    unsigned int threadCount() const {
+        return queues.size();
+    }
+
+    // calls body(chunkBegin, chunkEnd) for consecutive chunks of at most `grain` indices covering
+    // [begin, end), on any of the threads, and returns when all chunks are done
+    void parallelFor(unsigned int begin, unsigned int end, unsigned int grain,
+                     const std::function<void(unsigned int, unsigned int)>& body) {
+        if (end <= begin)
+            return;
+        grain = std::max(grain, 1u);
+        if (workers.empty() || end - begin <= grain) {
+            body(begin, end);
+            return;
+        }
+
+        unsigned int chunks = (end - begin + grain - 1) / grain;
+        std::atomic<unsigned int> pending(chunks);
+        for (unsigned int q = 0; q < queues.size(); q++) {
+            unsigned int first = (uint64_t) chunks * q / queues.size();
+            unsigned int last = (uint64_t) chunks * (q + 1) / queues.size();
+            if (first == last)
+                continue;
+            std::lock_guard<std::mutex> lock(queues[q]->mutex);
+            // the owner pops from the back, so it starts at the end of its block and thieves at the front
+            for (unsigned int chunk = first; chunk < last; chunk++) {
+                unsigned int chunkBegin = begin + chunk * grain;
+                queues[q]->jobs.push_back({&body, chunkBegin, std::min(chunkBegin + grain, end), &pending});
+            }
+            queued += last - first;
+        }
+        {
+            // a worker between checking `queued` and going to sleep holds this, so it can't miss the wake up
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_all();
+
+        Job job;
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (findJob(0, job))
+                run(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Job {
+        const std::function<void(unsigned int, unsigned int)>* body;
+        unsigned int begin, end;
+        std::atomic<unsigned int>* pending;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // queues[0] belongs to the thread calling parallelFor
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<unsigned int> queued{0};        // jobs waiting in any queue
+    bool stopping = false;
+
+    bool pop(unsigned int self, Job& job) {
+        Queue& queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            return false;
+        job = queue.jobs.back();
+        queue.jobs.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool steal(unsigned int self, Job& job) {
+        for (unsigned int i = 1; i < queues.size(); i++) {
+            Queue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findJob(unsigned int self, Job& job) {
+        return pop(self, job) || steal(self, job);
+    }
+
+    static void run(const Job& job) {
+        (*job.body)(job.begin, job.end);
+        job.pending->fetch_sub(1, std::memory_order_release);
+    }
+
+    void workerLoop(unsigned int self) {
+        Job job;
+        while (true) {
+            if (findJob(self, job)) {
+                run(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+            if (stopping)
+                return;
+        }
+    }
+};
+
+#endif //PROJECT_BASE_JOBSYSTEM_H
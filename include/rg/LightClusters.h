@@ -0,0 +1,221 @@
+#ifndef PROJECT_BASE_LIGHTCLUSTERS_H
+#define PROJECT_BASE_LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <learnopengl/shader.h>
+#include <rg/GLStateCache.h>
+#include <rg/PointLight.h>
+
+// Splits the view frustum into a grid of froxels (screen tiles x exponential depth slices) and
+// assigns every point light to the froxels its influence sphere touches. The result is uploaded
+// into two texture buffers: per cluster (first index, light count) and the packed light index lists.
+// The lighting shaders get the grid size as the CLUSTER_* defines of their variants.
+class LightClusterGrid {
+public:
+    static const unsigned int TilesX = 16;
+    static const unsigned int TilesY = 9;
+    static const unsigned int Slices = 24;
+    static const unsigned int ClusterCount = TilesX * TilesY * Slices;
+
+    // brightness below which a light is considered to not contribute anymore
+    float cutoff = 0.05f;
+
+    // statistics of the last build
+    unsigned int assignedLights = 0;
+    unsigned int maxLightsPerCluster = 0;
+
+    LightClusterGrid() {
+        glGenBuffers(1, &rangesBuffer);
+        glGenBuffers(1, &indicesBuffer);
+        glGenTextures(1, &rangesTexture);
+        glGenTextures(1, &indicesTexture);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, rangesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, ClusterCount * 2 * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, rangesTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, rangesBuffer);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, indicesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, indicesTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indicesBuffer);
+
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightClusterGrid() {
+        glDeleteTextures(1, &rangesTexture);
+        glDeleteTextures(1, &indicesTexture);
+        glDeleteBuffers(1, &rangesBuffer);
+        glDeleteBuffers(1, &indicesBuffer);
+    }
+
+    LightClusterGrid(const LightClusterGrid&) = delete;
+    LightClusterGrid& operator=(const LightClusterGrid&) = delete;
+
+    // assigns lights to clusters for the given camera and uploads the result
+    void build(const glm::mat4& view, float fovy, float aspect, float zNear, float zFar,
+               const PointLight* lights, unsigned int n) {
+        if (fovy != this->fovy || aspect != this->aspect || zNear != this->zNear || zFar != this->zFar)
+            computeClusterBounds(fovy, aspect, zNear, zFar);
+
+        pairs.clear();
+        float tanY = std::tan(fovy * 0.5f);
+        float tanX = tanY * aspect;
+        for (unsigned int i = 0; i < n; i++) {
+            float radius = lightInfluenceRadius(lights[i], cutoff, zFar);
+            if (radius <= 0.0f)
+                continue;
+            glm::vec3 center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            float dMin = -center.z - radius;
+            float dMax = -center.z + radius;
+            if (dMax < zNear || dMin > zFar)
+                continue;
+
+            unsigned int s0 = sliceOf(std::max(dMin, zNear));
+            unsigned int s1 = sliceOf(std::min(dMax, zFar));
+            unsigned int x0 = 0, x1 = TilesX - 1, y0 = 0, y1 = TilesY - 1;
+            if (dMin > zNear) {
+                // the sphere is fully in front of the camera, project its bounding box onto the screen
+                float nx0 = 1.0f, nx1 = -1.0f, ny0 = 1.0f, ny1 = -1.0f;
+                for (float d: {dMin, dMax}) {
+                    for (float sx: {-1.0f, 1.0f}) {
+                        float ndcX = (center.x + sx * radius) / (d * tanX);
+                        float ndcY = (center.y + sx * radius) / (d * tanY);
+                        nx0 = std::min(nx0, ndcX);
+                        nx1 = std::max(nx1, ndcX);
+                        ny0 = std::min(ny0, ndcY);
+                        ny1 = std::max(ny1, ndcY);
+                    }
+                }
+                if (nx1 < -1.0f || nx0 > 1.0f || ny1 < -1.0f || ny0 > 1.0f)
+                    continue;
+                x0 = tileOf(nx0, TilesX);
+                x1 = tileOf(nx1, TilesX);
+                y0 = tileOf(ny0, TilesY);
+                y1 = tileOf(ny1, TilesY);
+            }
+
+            for (unsigned int z = s0; z <= s1; z++)
+                for (unsigned int y = y0; y <= y1; y++)
+                    for (unsigned int x = x0; x <= x1; x++) {
+                        unsigned int cluster = x + TilesX * (y + TilesY * z);
+                        if (sphereIntersectsCluster(center, radius, cluster))
+                            pairs.push_back({cluster, i});
+                    }
+        }
+
+        // counting sort of the (cluster, light) pairs into contiguous per cluster lists
+        std::fill(ranges.begin(), ranges.end(), 0u);
+        for (const Pair& p: pairs)
+            ranges[2 * p.cluster + 1]++;
+        GLuint offset = 0;
+        maxLightsPerCluster = 0;
+        for (unsigned int c = 0; c < ClusterCount; c++) {
+            ranges[2 * c] = offset;
+            offset += ranges[2 * c + 1];
+            maxLightsPerCluster = std::max(maxLightsPerCluster, (unsigned int) ranges[2 * c + 1]);
+            ranges[2 * c + 1] = 0;
+        }
+        indices.resize(std::max<size_t>(pairs.size(), 1));
+        for (const Pair& p: pairs)
+            indices[ranges[2 * p.cluster] + ranges[2 * p.cluster + 1]++] = p.light;
+        assignedLights = pairs.size();
+
+        glBindBuffer(GL_TEXTURE_BUFFER, rangesBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, ranges.size() * sizeof(GLuint), ranges.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, indicesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // binds the cluster texture buffers and sets the uniforms the lighting shader needs to find its cluster
+    void bind(const Shader& shader, unsigned int rangesUnit, unsigned int indicesUnit,
+              float screenWidth, float screenHeight) const {
+        glState().bindTexture(rangesUnit, GL_TEXTURE_BUFFER, rangesTexture);
+        glState().bindTexture(indicesUnit, GL_TEXTURE_BUFFER, indicesTexture);
+
+        shader.setInt("clusterRanges", rangesUnit);
+        shader.setInt("clusterLightIndices", indicesUnit);
+        shader.setVec2("clusterTileSize", screenWidth / TilesX, screenHeight / TilesY);
+        shader.setFloat("clusterNear", zNear);
+        shader.setFloat("clusterSliceScale", Slices / std::log(zFar / zNear));
+    }
+
+private:
+    struct Pair {
+        unsigned int cluster;
+        unsigned int light;
+    };
+
+    unsigned int rangesBuffer, indicesBuffer;
+    unsigned int rangesTexture, indicesTexture;
+
+    float fovy = 0.0f, aspect = 0.0f, zNear = 0.0f, zFar = 0.0f;
+    std::vector<glm::vec3> clusterMin = std::vector<glm::vec3>(ClusterCount);
+    std::vector<glm::vec3> clusterMax = std::vector<glm::vec3>(ClusterCount);
+    std::vector<Pair> pairs;
+    std::vector<GLuint> ranges = std::vector<GLuint>(2 * ClusterCount);
+    std::vector<GLuint> indices;
+
+    // same exponential slicing as the shader: slice = log(d / near) * Slices / log(far / near)
+    unsigned int sliceOf(float depth) const {
+        int slice = (int) std::floor(std::log(depth / zNear) * Slices / std::log(zFar / zNear));
+        return (unsigned int) std::min(std::max(slice, 0), (int) Slices - 1);
+    }
+
+    static unsigned int tileOf(float ndc, unsigned int tiles) {
+        int tile = (int) std::floor((ndc * 0.5f + 0.5f) * tiles);
+        return (unsigned int) std::min(std::max(tile, 0), (int) tiles - 1);
+    }
+
+    // view space bounding boxes of all clusters, recomputed only when the projection changes
+    void computeClusterBounds(float fovy, float aspect, float zNear, float zFar) {
+        this->fovy = fovy;
+        this->aspect = aspect;
+        this->zNear = zNear;
+        this->zFar = zFar;
+        float tanY = std::tan(fovy * 0.5f);
+        float tanX = tanY * aspect;
+        for (unsigned int z = 0; z < Slices; z++) {
+            float d0 = zNear * std::pow(zFar / zNear, (float) z / Slices);
+            float d1 = zNear * std::pow(zFar / zNear, (float) (z + 1) / Slices);
+            for (unsigned int y = 0; y < TilesY; y++) {
+                float ny0 = -1.0f + 2.0f * y / TilesY;
+                float ny1 = -1.0f + 2.0f * (y + 1) / TilesY;
+                for (unsigned int x = 0; x < TilesX; x++) {
+                    float nx0 = -1.0f + 2.0f * x / TilesX;
+                    float nx1 = -1.0f + 2.0f * (x + 1) / TilesX;
+                    glm::vec3 lo(1e30f), hi(-1e30f);
+                    for (float d: {d0, d1}) {
+                        for (float nx: {nx0, nx1}) {
+                            for (float ny: {ny0, ny1}) {
+                                glm::vec3 p(nx * d * tanX, ny * d * tanY, -d);
+                                lo = glm::min(lo, p);
+                                hi = glm::max(hi, p);
+                            }
+                        }
+                    }
+                    unsigned int cluster = x + TilesX * (y + TilesY * z);
+                    clusterMin[cluster] = lo;
+                    clusterMax[cluster] = hi;
+                }
+            }
+        }
+    }
+
+    bool sphereIntersectsCluster(const glm::vec3& center, float radius, unsigned int cluster) const {
+        glm::vec3 closest = glm::clamp(center, clusterMin[cluster], clusterMax[cluster]);
+        glm::vec3 d = closest - center;
+        return glm::dot(d, d) <= radius * radius;
+    }
+};
+
+#endif //PROJECT_BASE_LIGHTCLUSTERS_H
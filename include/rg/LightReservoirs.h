@@ -0,0 +1,81 @@
+#ifndef PROJECT_BASE_LIGHTRESERVOIRS_H
+#define PROJECT_BASE_LIGHTRESERVOIRS_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#include <rg/GLStateCache.h>
+
+// Per pixel light reservoirs of the sampled lighting mode (restir.fs), one framebuffer per pass.
+// Every framebuffer has two RGBA32F targets: the reservoir (light, contribution weight, sample count)
+// and the surface it was made for (normal, view depth), which decides whether another pixel or the
+// next frame may reuse it.
+// The temporal pass reads the spatial pass' result of the last frame, the spatial pass reads the
+// temporal result of this frame, and the lighting pass shades the spatial result.
+class LightReservoirs {
+public:
+    enum Pass {
+        Temporal,
+        Spatial
+    };
+
+    LightReservoirs(unsigned int width, unsigned int height) {
+        glGenFramebuffers(2, framebuffers);
+        glGenTextures(4, &textures[0][0]);
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        for (unsigned int pass = 0; pass < 2; pass++) {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[pass]);
+            for (unsigned int i = 0; i < 2; i++) {
+                glState().bindTexture(0, GL_TEXTURE_2D, textures[pass][i]);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[pass][i], 0);
+            }
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "Light reservoir framebuffer not complete!" << std::endl;
+        }
+        glState().bindTexture(0, GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        reset();
+    }
+
+    ~LightReservoirs() {
+        glDeleteFramebuffers(2, framebuffers);
+        glDeleteTextures(4, &textures[0][0]);
+    }
+
+    LightReservoirs(const LightReservoirs&) = delete;
+    LightReservoirs& operator=(const LightReservoirs&) = delete;
+
+    // forgets the history, the next temporal pass starts from fresh candidates only
+    void reset() {
+        const float emptyReservoir[4] = { -1.0f, 0.0f, 0.0f, 0.0f };
+        const float noSurface[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[Spatial]);
+        glClearBufferfv(GL_COLOR, 0, emptyReservoir);
+        glClearBufferfv(GL_COLOR, 1, noSurface);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // renders the given pass into its reservoirs
+    void bindTarget(Pass pass) const {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[pass]);
+    }
+
+    // binds the reservoirs and surfaces written by the given pass
+    void bindTextures(Pass pass, unsigned int reservoirUnit, unsigned int surfaceUnit) const {
+        glState().bindTexture(reservoirUnit, GL_TEXTURE_2D, textures[pass][0]);
+        glState().bindTexture(surfaceUnit, GL_TEXTURE_2D, textures[pass][1]);
+    }
+
+private:
+    unsigned int framebuffers[2];
+    unsigned int textures[2][2];
+};
+
+#endif //PROJECT_BASE_LIGHTRESERVOIRS_H
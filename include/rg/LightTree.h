@@ -0,0 +1,142 @@
+#ifndef PROJECT_BASE_LIGHTTREE_H
+#define PROJECT_BASE_LIGHTTREE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <rg/GLStateCache.h>
+#include <rg/PointLight.h>
+
+// Lightcuts style light hierarchy: a binary BVH over the point lights whose internal nodes are
+// virtual lights standing in for their whole subtree (summed colors at the position and attenuation
+// of a representative light). The shader walks the tree top down and stops at the first node whose
+// upper bound on the contribution to the fragment is below the error bound, so far away groups of
+// fireflies cost one light evaluation instead of one per firefly.
+//
+// Nodes are stored in an RGBA32F texture buffer, 5 texels per node:
+//  0: bounding box min, first child (children are allocated in pairs) or -(light + 1) for leaves
+//  1: bounding box max, representative light
+//  2: summed ambient, smallest constant attenuation term of the subtree
+//  3: summed diffuse, smallest linear term
+//  4: summed specular, smallest quadratic term
+// Indices are stored as float values, which is exact up to 2^24 nodes.
+class LightTree {
+public:
+    static const unsigned int TexelsPerNode = 5;
+
+    // statistics of the last build
+    unsigned int nodeCount = 0;
+
+    LightTree() {
+        glGenBuffers(1, &nodesBuffer);
+        glGenTextures(1, &nodesTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, nodesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, TexelsPerNode * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, nodesTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, nodesBuffer);
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightTree() {
+        glDeleteTextures(1, &nodesTexture);
+        glDeleteBuffers(1, &nodesBuffer);
+    }
+
+    LightTree(const LightTree&) = delete;
+    LightTree& operator=(const LightTree&) = delete;
+
+    // depth of the tree over n lights, the lights are split at the median so it is balanced
+    static unsigned int depth(unsigned int n) {
+        unsigned int d = 0;
+        while ((1u << d) < n)
+            d++;
+        return d;
+    }
+
+    // rebuilds the tree from the current lights and uploads it
+    void build(const PointLight* lights, unsigned int n) {
+        this->lights = lights;
+        order.resize(n);
+        for (unsigned int i = 0; i < n; i++)
+            order[i] = i;
+        nodes.resize(std::max(2 * n, 2u) * TexelsPerNode);
+        nodeCount = n > 0 ? 1 : 0;
+        if (n > 0)
+            buildNode(0, 0, n);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, nodesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(nodeCount, 1u) * TexelsPerNode * sizeof(glm::vec4), nodes.data(),
+                     GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void bind(unsigned int unit) const {
+        glState().bindTexture(unit, GL_TEXTURE_BUFFER, nodesTexture);
+    }
+
+private:
+    // what a parent needs to know about a built child
+    struct Summary {
+        unsigned int representative;
+        float intensity;
+    };
+
+    unsigned int nodesBuffer, nodesTexture;
+    const PointLight* lights = nullptr;
+    std::vector<unsigned int> order;
+    std::vector<glm::vec4> nodes;
+
+    static float intensityOf(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular) {
+        glm::vec3 sum = ambient + diffuse + specular;
+        return std::max(sum.x, std::max(sum.y, sum.z));
+    }
+
+    Summary buildNode(unsigned int node, unsigned int begin, unsigned int end) {
+        glm::vec4* texels = &nodes[node * TexelsPerNode];
+        if (end - begin == 1) {
+            const PointLight& light = lights[order[begin]];
+            texels[0] = glm::vec4(light.position, -(float) order[begin] - 1.0f);
+            texels[1] = glm::vec4(light.position, (float) order[begin]);
+            texels[2] = glm::vec4(light.ambient, light.constant);
+            texels[3] = glm::vec4(light.diffuse, light.linear);
+            texels[4] = glm::vec4(light.specular, light.quadratic);
+            return {order[begin], intensityOf(light.ambient, light.diffuse, light.specular)};
+        }
+
+        glm::vec3 boxMin(lights[order[begin]].position), boxMax(boxMin);
+        for (unsigned int i = begin + 1; i < end; i++) {
+            boxMin = glm::min(boxMin, lights[order[i]].position);
+            boxMax = glm::max(boxMax, lights[order[i]].position);
+        }
+        // median split along the longest axis of the box
+        glm::vec3 extent = boxMax - boxMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        unsigned int middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                         [this, axis](unsigned int a, unsigned int b) {
+                             return lights[a].position[axis] < lights[b].position[axis];
+                         });
+
+        unsigned int left = nodeCount;
+        nodeCount += 2;
+        Summary l = buildNode(left, begin, middle);
+        Summary r = buildNode(left + 1, middle, end);
+
+        // the children are final, combine them. The brighter child's representative keeps
+        // the virtual light stable from frame to frame.
+        const glm::vec4* a = &nodes[left * TexelsPerNode];
+        const glm::vec4* b = &nodes[(left + 1) * TexelsPerNode];
+        unsigned int representative = l.intensity >= r.intensity ? l.representative : r.representative;
+        texels[0] = glm::vec4(boxMin, (float) left);
+        texels[1] = glm::vec4(boxMax, (float) representative);
+        for (unsigned int t = 2; t < TexelsPerNode; t++)
+            texels[t] = glm::vec4(glm::vec3(a[t]) + glm::vec3(b[t]), std::min(a[t].w, b[t].w));
+        return {representative, intensityOf(glm::vec3(texels[2]), glm::vec3(texels[3]), glm::vec3(texels[4]))};
+    }
+};
+
+#endif //PROJECT_BASE_LIGHTTREE_H
@@ -0,0 +1,142 @@
+#ifndef PROJECT_BASE_LIGHTVOLUMES_H
+#define PROJECT_BASE_LIGHTVOLUMES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <rg/GLStateCache.h>
+#include <rg/PointLight.h>
+#include <rg/StreamingBuffer.h>
+
+// Deferred point lights drawn as spheres bounding each light's influence. One instanced draw
+// covers all lights, every instance carries the sphere (center, radius) and the index of its
+// light in the PointLightBuffer. Lights whose radius is zero are not drawn at all.
+// The instances are written to a StreamingBuffer every frame.
+class LightVolumes {
+public:
+    // brightness below which a light is considered to not contribute anymore
+    float cutoff = 0.05f;
+
+    LightVolumes() {
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+        generateSphere(vertices, indices, 16, 8);
+        indexCount = indices.size();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glState().bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+        // per instance: sphere center and radius, light index, pointed at the stream in update()
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribDivisor(2, 1);
+        glState().bindVertexArray(0);
+    }
+
+    ~LightVolumes() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+    LightVolumes(const LightVolumes&) = delete;
+    LightVolumes& operator=(const LightVolumes&) = delete;
+
+    // bytes update() streams at most for n lights
+    static GLsizeiptr streamSize(unsigned int n) {
+        return n * sizeof(Instance);
+    }
+
+    // rebuilds the instances from the current light positions and attenuation and streams them
+    void update(const PointLight* lights, unsigned int n, float maxRadius, StreamingBuffer& stream) {
+        instances.clear();
+        for (unsigned int i = 0; i < n; i++) {
+            float radius = lightInfluenceRadius(lights[i], cutoff, maxRadius);
+            if (radius > 0.0f)
+                instances.push_back({lights[i].position, radius, i});
+        }
+        if (instances.empty())
+            return;
+        StreamingBuffer::Allocation allocation = stream.upload(instances.data(), instances.size() * sizeof(Instance));
+        if (!allocation.data) {
+            instances.clear();
+            return;
+        }
+        glState().bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, stream.buffer());
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)allocation.offset);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(Instance),
+                               (void*)(allocation.offset + offsetof(Instance, light)));
+        glState().bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void draw() const {
+        glState().bindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instances.size());
+    }
+
+    unsigned int count() const {
+        return instances.size();
+    }
+
+private:
+    struct Instance {
+        glm::vec3 center;
+        float radius;
+        GLuint light;
+    };
+
+    unsigned int VAO, VBO, EBO;
+    unsigned int indexCount;
+    std::vector<Instance> instances;
+
+    // unit UV sphere, pushed out slightly so its flat faces never cut into the real sphere
+    static void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices,
+                               unsigned int sectors, unsigned int stacks) {
+        const float PI = 3.14159265359f;
+        float scale = 1.0f / (std::cos(PI / sectors) * std::cos(PI / (2.0f * stacks)));
+        for (unsigned int i = 0; i <= stacks; i++) {
+            float phi = PI / 2.0f - PI * i / stacks;
+            for (unsigned int j = 0; j <= sectors; j++) {
+                float theta = 2.0f * PI * j / sectors;
+                vertices.push_back(scale * std::cos(phi) * std::cos(theta));
+                vertices.push_back(scale * std::sin(phi));
+                vertices.push_back(scale * std::cos(phi) * std::sin(theta));
+            }
+        }
+        for (unsigned int i = 0; i < stacks; i++) {
+            for (unsigned int j = 0; j < sectors; j++) {
+                unsigned int k1 = i * (sectors + 1) + j;
+                unsigned int k2 = k1 + sectors + 1;
+                // counter-clockwise when seen from outside
+                if (i != 0) {
+                    indices.push_back(k1);
+                    indices.push_back(k1 + 1);
+                    indices.push_back(k2);
+                }
+                if (i != stacks - 1) {
+                    indices.push_back(k1 + 1);
+                    indices.push_back(k2 + 1);
+                    indices.push_back(k2);
+                }
+            }
+        }
+    }
+};
+
+#endif //PROJECT_BASE_LIGHTVOLUMES_H
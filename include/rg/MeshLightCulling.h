@@ -0,0 +1,69 @@
+#ifndef PROJECT_BASE_MESHLIGHTCULLING_H
+#define PROJECT_BASE_MESHLIGHTCULLING_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <rg/PointLight.h>
+
+// Per object light lists: for every draw, only the lights whose influence sphere overlaps the
+// world space bounding box of the mesh are passed to the shader. Much cheaper to set up than
+// clustered shading, meant for machines where building the cluster grid is too heavy.
+class MeshLightCuller {
+public:
+    // has to match MAX_MESH_LIGHTS in 2.model_lighting.fs
+    static const unsigned int MaxLightsPerMesh = 64;
+
+    // brightness below which a light is considered to not contribute anymore
+    float cutoff = 0.05f;
+
+    // computes the influence spheres of this frame's lights
+    void setLights(const PointLight* lights, unsigned int n, float maxRadius) {
+        spheres.resize(n);
+        for (unsigned int i = 0; i < n; i++)
+            spheres[i] = glm::vec4(lights[i].position, lightInfluenceRadius(lights[i], cutoff, maxRadius));
+    }
+
+    // fills `indices` with the lights touching the model space box transformed by `model`,
+    // returns false when there are more than MaxLightsPerMesh of them and the mesh needs all lights
+    bool cull(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model,
+              std::vector<int>& indices) const {
+        glm::vec3 worldMin, worldMax;
+        transformBounds(boundsMin, boundsMax, model, worldMin, worldMax);
+
+        indices.clear();
+        for (unsigned int i = 0; i < spheres.size(); i++) {
+            glm::vec3 center(spheres[i]);
+            float radius = spheres[i].w;
+            glm::vec3 d = glm::clamp(center, worldMin, worldMax) - center;
+            if (radius > 0.0f && glm::dot(d, d) <= radius * radius) {
+                if (indices.size() == MaxLightsPerMesh)
+                    return false;
+                indices.push_back(i);
+            }
+        }
+        return true;
+    }
+
+    // bounding box of the 8 transformed corners
+    static void transformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model,
+                                glm::vec3& worldMin, glm::vec3& worldMax) {
+        worldMin = glm::vec3(1e30f);
+        worldMax = glm::vec3(-1e30f);
+        for (unsigned int corner = 0; corner < 8; corner++) {
+            glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x,
+                        (corner & 2) ? boundsMax.y : boundsMin.y,
+                        (corner & 4) ? boundsMax.z : boundsMin.z);
+            glm::vec3 world = glm::vec3(model * glm::vec4(p, 1.0f));
+            worldMin = glm::min(worldMin, world);
+            worldMax = glm::max(worldMax, world);
+        }
+    }
+
+private:
+    std::vector<glm::vec4> spheres;
+};
+
+#endif //PROJECT_BASE_MESHLIGHTCULLING_H
@@ -0,0 +1,189 @@
+#ifndef PROJECT_BASE_MODELCOLLIDER_H
+#define PROJECT_BASE_MODELCOLLIDER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+#include <rg/FireflySystem.h>
+#include <rg/JobSystem.h>
+#include <rg/Random.h>
+#include <rg/TriangleBVH.h>
+
+// A TriangleBVH placed in the world the way its model is drawn, translated and uniformly scaled (the
+// forest). Queries take and return world space; they are moved into model space instead of rebuilding
+// the hierarchy when the model is moved. Small enough to be copied to the simulation thread.
+class ModelCollider {
+public:
+    const TriangleBVH* bvh = nullptr;   // no collisions without one
+    glm::vec3 position = glm::vec3(0.0f);
+    float scale = 1.0f;
+    // how far fireflies are put back from the surface they hit, world units
+    float skin = 0.02f;
+
+    ModelCollider() {
+    }
+
+    ModelCollider(const TriangleBVH* bvh, const glm::vec3& position, float scale)
+            : bvh(bvh), position(position), scale(scale) {
+    }
+
+    // closest hit along the ray within maxDistance, hit.t is the distance (direction normalized)
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, TriangleBVH::Hit& hit) const {
+        if (!bvh || !bvh->intersect(toModel(origin), direction, maxDistance / scale, hit))
+            return false;
+        hit.t *= scale;
+        return true;
+    }
+
+    bool overlapsSphere(const glm::vec3& center, float radius) const {
+        return bvh && bvh->overlapsSphere(toModel(center), radius / scale);
+    }
+
+    // fireflies [begin, end) after FireflySystem::integrate: the step each one just took (from p - v to
+    // p) is tested against the triangles, on a hit the firefly stops at the surface and bounces off it.
+    // The step back ignores the vertical clamp of integrate, at the limits it is a bit off.
+    void collide(FireflySystem& fireflies, unsigned int begin, unsigned int end, float yLimit) const {
+        if (!bvh)
+            return;
+        const unsigned int Batch = 64;
+        glm::vec3 from[Batch], to[Batch];
+        TriangleBVH::Hit hits[Batch];
+        for (unsigned int first = begin; first < end; first += Batch) {
+            unsigned int n = std::min(end - first, Batch);
+            for (unsigned int k = 0; k < n; k++) {
+                unsigned int i = first + k;
+                glm::vec3 p(fireflies.px[i], fireflies.py[i], fireflies.pz[i]);
+                glm::vec3 v(fireflies.vx[i], fireflies.vy[i], fireflies.vz[i]);
+                from[k] = toModel(p - v);
+                to[k] = toModel(p);
+            }
+            if (bvh->intersectSegments(from, to, n, hits) == 0)
+                continue;
+            for (unsigned int k = 0; k < n; k++) {
+                if (hits[k].triangle != TriangleBVH::Miss)
+                    bounce(fireflies, first + k, from[k], to[k], hits[k], yLimit);
+            }
+        }
+    }
+
+    // same for one firefly that moved from `previous` to where it is now, over several steps (FireflyLod)
+    void collide(FireflySystem& fireflies, unsigned int i, const glm::vec3& previous, float yLimit) const {
+        if (!bvh)
+            return;
+        glm::vec3 from = toModel(previous), to = toModel(fireflies.position(i));
+        TriangleBVH::Hit hit;
+        if (bvh->intersectSegments(&from, &to, 1, &hit) > 0)
+            bounce(fireflies, i, from, to, hit, yLimit);
+    }
+
+private:
+    // puts the firefly in front of the surface it hit on its way from -> to (model space), velocity mirrored
+    void bounce(FireflySystem& fireflies, unsigned int i, const glm::vec3& from, const glm::vec3& to,
+                const TriangleBVH::Hit& hit, float yLimit) const {
+        const glm::vec3& normal = hit.normal;
+        glm::vec3 p = position + (from + (to - from) * hit.t) * scale + normal * skin;
+        glm::vec3 v(fireflies.vx[i], fireflies.vy[i], fireflies.vz[i]);
+        v -= normal * (2.0f * glm::dot(v, normal));
+        fireflies.px[i] = p.x;
+        fireflies.py[i] = std::min(std::max(p.y, -yLimit), yLimit);
+        fireflies.pz[i] = p.z;
+        fireflies.vx[i] = v.x;
+        fireflies.vy[i] = v.y;
+        fireflies.vz[i] = v.z;
+    }
+
+    glm::vec3 toModel(const glm::vec3& p) const {
+        return (p - position) / scale;
+    }
+};
+
+// a stand-in for the forest: trunks (open cylinders) with a cloud of leaf triangles on top, over
+// [-extent, extent] on x and z, from y = 0 up to 10
+inline void buildBenchmarkForest(TriangleBVH& bvh, unsigned int trees, float extent, uint32_t seed) {
+    const unsigned int Sides = 12, Rings = 8, Leaves = 400;
+    for (unsigned int tree = 0; tree < trees; tree++) {
+        uint32_t key = randomKey(seed, tree);
+        glm::vec3 base(randomSigned(randomBits(key, 0)) * extent, 0.0f, randomSigned(randomBits(key, 1)) * extent);
+        float radius = 0.2f + 0.1f * randomSigned(randomBits(key, 2)), height = 6.0f;
+        for (unsigned int ring = 0; ring < Rings; ring++) {
+            float y0 = height * ring / Rings, y1 = height * (ring + 1) / Rings;
+            for (unsigned int side = 0; side < Sides; side++) {
+                float a0 = 6.2831853f * side / Sides, a1 = 6.2831853f * (side + 1) / Sides;
+                glm::vec3 d0(std::cos(a0) * radius, 0.0f, std::sin(a0) * radius);
+                glm::vec3 d1(std::cos(a1) * radius, 0.0f, std::sin(a1) * radius);
+                glm::vec3 p00 = base + d0 + glm::vec3(0.0f, y0, 0.0f), p10 = base + d1 + glm::vec3(0.0f, y0, 0.0f);
+                glm::vec3 p01 = base + d0 + glm::vec3(0.0f, y1, 0.0f), p11 = base + d1 + glm::vec3(0.0f, y1, 0.0f);
+                bvh.addTriangle(p00, p10, p11);
+                bvh.addTriangle(p00, p11, p01);
+            }
+        }
+        glm::vec3 crown = base + glm::vec3(0.0f, height + 1.0f, 0.0f);
+        for (unsigned int leaf = 0; leaf < Leaves; leaf++) {
+            uint32_t counter = 3 + 9 * leaf;
+            glm::vec3 centre = crown + 2.0f * glm::vec3(randomSigned(randomBits(key, counter)),
+                                                        randomSigned(randomBits(key, counter + 1)),
+                                                        randomSigned(randomBits(key, counter + 2)));
+            glm::vec3 corners[3];
+            for (unsigned int c = 0; c < 3; c++)
+                corners[c] = centre + 0.3f * glm::vec3(randomSigned(randomBits(key, counter + 3 + 3 * c)),
+                                                       randomSigned(randomBits(key, counter + 4 + 3 * c)),
+                                                       randomSigned(randomBits(key, counter + 5 + 3 * c)));
+            bvh.addTriangle(corners[0], corners[1], corners[2]);
+        }
+    }
+    bvh.build();
+}
+
+// time per tick of the collision pass for 10k fireflies moving through a synthetic forest, on one thread
+// and on all of them (--benchmark)
+inline void benchmarkModelCollider(std::ostream& out, JobSystem& jobs, unsigned int grain) {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned int n = 10000, ticks = 200, trees = 300;
+    const float extent = 40.0f, yLimit = 5.0f, maxSpeed = 0.01f;
+
+    Clock::time_point start = Clock::now();
+    TriangleBVH bvh;
+    buildBenchmarkForest(bvh, trees, extent, 7);
+    double buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    out << "BVH over " << bvh.triangleCount() << " triangles: " << bvh.nodeCount() << " nodes, built in "
+        << buildSeconds * 1e3 << " ms\n";
+    // placed like the forest, its ground at the fireflies' lower limit
+    ModelCollider collider(&bvh, glm::vec3(0.0f, -yLimit, 0.0f), 1.0f);
+
+    JobSystem serial(0);
+    for (unsigned int run = 0; run < 2; run++) {
+        JobSystem& pool = run == 0 ? serial : jobs;
+        unsigned int threads = pool.threadCount();
+        if (run == 1 && threads == 1)
+            continue;
+        FireflySystem fireflies(n);
+        for (unsigned int i = 0; i < n; i++) {
+            uint32_t key = randomKey(fireflies.seed, i);
+            fireflies.setPosition(i, glm::vec3(randomSigned(randomBits(key, 0)) * extent,
+                                               randomSigned(randomBits(key, 1)) * yLimit,
+                                               randomSigned(randomBits(key, 2)) * extent));
+        }
+
+        double seconds = 0.0;
+        for (unsigned int tick = 1; tick <= ticks; tick++) {
+            if (tick % 20 == 1)
+                fireflies.retarget(tick / 20 + 1, maxSpeed * 10.0f, yLimit);
+            fireflies.integrate(yLimit);
+            Clock::time_point tickStart = Clock::now();
+            pool.parallelFor(0, n, grain, [&fireflies, &collider, yLimit](unsigned int begin, unsigned int end) {
+                collider.collide(fireflies, begin, end, yLimit);
+            });
+            seconds += std::chrono::duration<double>(Clock::now() - tickStart).count();
+        }
+
+        out << n << " fireflies colliding, " << threads << " thread(s): " << seconds / ticks * 1e3 << " ms/tick"
+            << " (checksum " << fireflies.px[n / 2] + fireflies.py[n / 3] + fireflies.pz[n - 1] << ")\n";
+    }
+}
+
+#endif //PROJECT_BASE_MODELCOLLIDER_H
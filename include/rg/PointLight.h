@@ -0,0 +1,42 @@
+#ifndef PROJECT_BASE_POINTLIGHT_H
+#define PROJECT_BASE_POINTLIGHT_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+struct PointLight {
+    glm::vec3 position;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+// distance at which the brightest channel of the light, attenuated by
+// 1 / (constant + linear * d + quadratic * d^2), falls below `cutoff`
+inline float lightInfluenceRadius(const PointLight& light, float cutoff, float maxRadius) {
+    glm::vec3 color = light.ambient + light.diffuse + light.specular;
+    float intensity = std::max(color.r, std::max(color.g, color.b));
+    if (intensity <= 0.0f)
+        return 0.0f;
+    // solve quadratic * d^2 + linear * d + (constant - intensity / cutoff) = 0 for d
+    float c = light.constant - intensity / cutoff;
+    // already below the cutoff at the light itself
+    if (c >= 0.0f)
+        return 0.0f;
+    float d;
+    if (light.quadratic > 0.0f)
+        d = (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    else if (light.linear > 0.0f)
+        d = -c / light.linear;
+    else
+        return maxRadius;
+    return std::min(std::max(d, 0.0f), maxRadius);
+}
+
+#endif //PROJECT_BASE_POINTLIGHT_H
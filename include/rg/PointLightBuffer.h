@@ -0,0 +1,131 @@
+#ifndef PROJECT_BASE_POINTLIGHTBUFFER_H
+#define PROJECT_BASE_POINTLIGHTBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <rg/GLStateCache.h>
+#include <rg/PointLight.h>
+
+// Point lights stored in two RGBA32F texture buffers, so the number of lights is only limited
+// by GL_MAX_TEXTURE_BUFFER_SIZE and known at runtime:
+//  - positions: one texel per light (xyz)
+//  - properties: three texels per light (ambient + constant, diffuse + linear, specular + quadratic)
+// Positions change every frame while the rest rarely does, so the two are uploaded separately.
+// Every stream is double-buffered and only the range of lights that changed since a buffer
+// was last filled is uploaded, with one glBufferSubData per stream.
+class PointLightBuffer {
+public:
+    explicit PointLightBuffer(unsigned int capacity)
+            : capacity(capacity), positions(capacity), properties(3 * capacity) {
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (3 * capacity > (unsigned int) maxTexels) {
+            std::cerr << "PointLightBuffer of " << capacity << " lights exceeds GL_MAX_TEXTURE_BUFFER_SIZE ("
+                      << maxTexels << " texels)\n";
+        }
+
+        glGenBuffers(4, &buffers[0][0]);
+        glGenTextures(4, &textures[0][0]);
+        for (unsigned int stream = 0; stream < 2; stream++) {
+            for (unsigned int i = 0; i < 2; i++) {
+                glBindBuffer(GL_TEXTURE_BUFFER, buffers[stream][i]);
+                glBufferData(GL_TEXTURE_BUFFER, streamSize(stream), nullptr, GL_DYNAMIC_DRAW);
+                glState().bindTexture(0, GL_TEXTURE_BUFFER, textures[stream][i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[stream][i]);
+                markDirty(stream, i, 0, capacity);
+            }
+        }
+        glState().bindTexture(0, GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~PointLightBuffer() {
+        glDeleteTextures(4, &textures[0][0]);
+        glDeleteBuffers(4, &buffers[0][0]);
+    }
+
+    PointLightBuffer(const PointLightBuffer&) = delete;
+    PointLightBuffer& operator=(const PointLightBuffer&) = delete;
+
+    // copies the light into the buffers, marking only what actually changed as dirty
+    void set(unsigned int i, const PointLight& light) {
+        glm::vec4 position(light.position, 1.0f);
+        if (!(position == positions[i])) {
+            positions[i] = position;
+            markDirty(Positions, 0, i, i + 1);
+            markDirty(Positions, 1, i, i + 1);
+        }
+        glm::vec4 ambient(light.ambient, light.constant);
+        glm::vec4 diffuse(light.diffuse, light.linear);
+        glm::vec4 specular(light.specular, light.quadratic);
+        glm::vec4* p = &properties[3 * i];
+        if (!(ambient == p[0] && diffuse == p[1] && specular == p[2])) {
+            p[0] = ambient;
+            p[1] = diffuse;
+            p[2] = specular;
+            markDirty(Properties, 0, i, i + 1);
+            markDirty(Properties, 1, i, i + 1);
+        }
+    }
+
+    // switches to the other set of buffers and uploads what changed since it was last filled
+    void upload() {
+        current = 1 - current;
+        upload(Positions, &positions[0], 1);
+        upload(Properties, &properties[0], 3);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void bind(unsigned int positionsUnit, unsigned int propertiesUnit) const {
+        glState().bindTexture(positionsUnit, GL_TEXTURE_BUFFER, textures[Positions][current]);
+        glState().bindTexture(propertiesUnit, GL_TEXTURE_BUFFER, textures[Properties][current]);
+    }
+
+private:
+    enum Stream {
+        Positions,
+        Properties
+    };
+
+    struct Range {
+        unsigned int begin = ~0u;
+        unsigned int end = 0;
+    };
+
+    unsigned int capacity;
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> properties;
+    unsigned int buffers[2][2];
+    unsigned int textures[2][2];
+    Range dirtyRanges[2][2];
+    unsigned int current = 0;
+
+    GLsizeiptr streamSize(unsigned int stream) const {
+        return capacity * (stream == Positions ? 1 : 3) * sizeof(glm::vec4);
+    }
+
+    void markDirty(unsigned int stream, unsigned int buffer, unsigned int begin, unsigned int end) {
+        Range& range = dirtyRanges[stream][buffer];
+        range.begin = std::min(range.begin, begin);
+        range.end = std::max(range.end, end);
+    }
+
+    void upload(unsigned int stream, const glm::vec4* data, unsigned int texelsPerLight) {
+        Range& dirty = dirtyRanges[stream][current];
+        if (dirty.begin >= dirty.end)
+            return;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[stream][current]);
+        glBufferSubData(GL_TEXTURE_BUFFER,
+                        dirty.begin * texelsPerLight * sizeof(glm::vec4),
+                        (dirty.end - dirty.begin) * texelsPerLight * sizeof(glm::vec4),
+                        data + dirty.begin * texelsPerLight);
+        dirty = Range();
+    }
+};
+
+#endif //PROJECT_BASE_POINTLIGHTBUFFER_H
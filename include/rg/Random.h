@@ -0,0 +1,135 @@
+#ifndef PROJECT_BASE_RANDOM_H
+#define PROJECT_BASE_RANDOM_H
+
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RANDOM_SIMD
+#include <immintrin.h>
+#endif
+
+// Counter-based random numbers: every value is a hash of (seed, stream, counter) and nothing is
+// carried from one draw to the next. Any value can be computed on any thread, in any order, in a
+// SIMD lane or in a shader (firefly_update.vs) and always comes out the same.
+// SplitMix style: the key of a stream is hashed from the seed and the stream number, the counter
+// is added as a multiple of the golden ratio and the sum goes through the lowbias32 finalizer.
+// Simulations use one stream per object (firefly) and derive the counter from the time step.
+
+// lowbias32 finalizer (Chris Wellons' hash prospector), every input bit affects every output bit
+inline uint32_t randomMix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// key of a stream, computed once when several counters of the same stream are drawn
+inline uint32_t randomKey(uint32_t seed, uint32_t stream) {
+    return randomMix(seed ^ randomMix(stream + 0x9e3779b9u));
+}
+
+inline uint32_t randomBits(uint32_t key, uint32_t counter) {
+    return randomMix(key + counter * 0x9e3779b9u);
+}
+
+inline uint32_t randomBits(uint32_t seed, uint32_t stream, uint32_t counter) {
+    return randomBits(randomKey(seed, stream), counter);
+}
+
+// the top 24 bits as a float in [-1, 1)
+inline float randomSigned(uint32_t bits) {
+    return (float) (int32_t) (bits >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+#ifdef RANDOM_SIMD
+// the same hash for 4 (SSE2) and 8 (AVX2) streams at once
+
+// SSE2 has no 32 bit multiply, the even and odd lanes are multiplied as 64 bit and put back together
+__attribute__((target("sse2")))
+inline __m128i randomMulSSE2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+inline __m128i randomMixSSE2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = randomMulSSE2(x, _mm_set1_epi32((int) 0x7feb352du));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = randomMulSSE2(x, _mm_set1_epi32((int) 0x846ca68bu));
+    return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+}
+
+__attribute__((target("sse2")))
+inline __m128i randomKeySSE2(uint32_t seed, __m128i streams) {
+    __m128i stream = randomMixSSE2(_mm_add_epi32(streams, _mm_set1_epi32((int) 0x9e3779b9u)));
+    return randomMixSSE2(_mm_xor_si128(_mm_set1_epi32((int) seed), stream));
+}
+
+__attribute__((target("sse2")))
+inline __m128i randomBitsSSE2(__m128i keys, uint32_t counter) {
+    return randomMixSSE2(_mm_add_epi32(keys, _mm_set1_epi32((int) (counter * 0x9e3779b9u))));
+}
+
+__attribute__((target("avx2")))
+inline __m256i randomMixAVX2(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int) 0x7feb352du));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int) 0x846ca68bu));
+    return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+__attribute__((target("avx2")))
+inline __m256i randomKeyAVX2(uint32_t seed, __m256i streams) {
+    __m256i stream = randomMixAVX2(_mm256_add_epi32(streams, _mm256_set1_epi32((int) 0x9e3779b9u)));
+    return randomMixAVX2(_mm256_xor_si256(_mm256_set1_epi32((int) seed), stream));
+}
+
+__attribute__((target("avx2")))
+inline __m256i randomBitsAVX2(__m256i keys, uint32_t counter) {
+    return randomMixAVX2(_mm256_add_epi32(keys, _mm256_set1_epi32((int) (counter * 0x9e3779b9u))));
+}
+
+__attribute__((target("avx2")))
+inline unsigned int randomBitsBatchAVX2(uint32_t seed, uint32_t firstStream, uint32_t counter, uint32_t* out,
+                                        unsigned int n) {
+    unsigned int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i streams = _mm256_add_epi32(_mm256_set1_epi32((int) (firstStream + i)),
+                                           _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        _mm256_storeu_si256((__m256i*) &out[i], randomBitsAVX2(randomKeyAVX2(seed, streams), counter));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+inline unsigned int randomBitsBatchSSE2(uint32_t seed, uint32_t firstStream, uint32_t counter, uint32_t* out,
+                                        unsigned int n) {
+    unsigned int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i streams = _mm_add_epi32(_mm_set1_epi32((int) (firstStream + i)), _mm_setr_epi32(0, 1, 2, 3));
+        _mm_storeu_si128((__m128i*) &out[i], randomBitsSSE2(randomKeySSE2(seed, streams), counter));
+    }
+    return i;
+}
+#endif
+
+// out[i] = randomBits(seed, firstStream + i, counter) for n consecutive streams, in SIMD where the CPU has it
+inline void randomBitsBatch(uint32_t seed, uint32_t firstStream, uint32_t counter, uint32_t* out, unsigned int n) {
+    unsigned int i = 0;
+#ifdef RANDOM_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        i = randomBitsBatchAVX2(seed, firstStream, counter, out, n);
+    else if (__builtin_cpu_supports("sse2"))
+        i = randomBitsBatchSSE2(seed, firstStream, counter, out, n);
+#endif
+    for (; i < n; i++)
+        out[i] = randomBits(seed, firstStream + i, counter);
+}
+
+#endif //PROJECT_BASE_RANDOM_H
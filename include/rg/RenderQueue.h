@@ -0,0 +1,97 @@
+#ifndef PROJECT_BASE_RENDERQUEUE_H
+#define PROJECT_BASE_RENDERQUEUE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The draws of a frame as packets of a 64 bit sort key and an item (whatever the caller needs to find
+// what to draw, e.g. a mesh index). From the top bit down the key holds
+//  - pass (4 bits): the order things have to be drawn in, e.g. opaque before alpha tested
+//  - shader (12 bits): draws with the same program follow each other
+//  - material (16 bits): then those with the same textures
+//  - depth (32 bits): then front to back, so the depth test rejects hidden fragments before they are
+//    shaded. The bits of a non-negative float sort like the float.
+// Packets are pushed in any order, sort() radix sorts them by key and submit() hands them out in that
+// order, the caller changes shader and state when the key says so.
+class RenderQueue {
+public:
+    struct Packet {
+        uint64_t key;
+        unsigned int item;
+    };
+
+    static uint64_t key(unsigned int pass, unsigned int shader, unsigned int material, float depth) {
+        // negative (behind the camera) and NaN depths go first
+        uint32_t depthBits = 0;
+        if (depth > 0.0f)
+            std::memcpy(&depthBits, &depth, sizeof(depthBits));
+        return (uint64_t) (pass & 0xfu) << 60 | (uint64_t) (shader & 0xfffu) << 48
+               | (uint64_t) (material & 0xffffu) << 32 | depthBits;
+    }
+
+    static unsigned int pass(uint64_t key) {
+        return key >> 60;
+    }
+
+    static unsigned int shader(uint64_t key) {
+        return (key >> 48) & 0xfffu;
+    }
+
+    static unsigned int material(uint64_t key) {
+        return (key >> 32) & 0xffffu;
+    }
+
+    void clear() {
+        queue.clear();
+    }
+
+    void push(uint64_t key, unsigned int item) {
+        queue.push_back({key, item});
+    }
+
+    // least significant byte first, skipping the bytes every key has in common (most of the pass and
+    // shader bits). Stable, packets with equal keys stay in the order they were pushed.
+    void sort() {
+        unsigned int n = queue.size();
+        scratch.resize(n);
+        for (unsigned int shift = 0; shift < 64; shift += 8) {
+            unsigned int counts[256] = {};
+            for (const Packet& packet: queue)
+                counts[(packet.key >> shift) & 0xffu]++;
+            if (n == 0 || counts[(queue[0].key >> shift) & 0xffu] == n)
+                continue;
+            unsigned int offsets[256];
+            unsigned int sum = 0;
+            for (unsigned int digit = 0; digit < 256; digit++) {
+                offsets[digit] = sum;
+                sum += counts[digit];
+            }
+            for (const Packet& packet: queue)
+                scratch[offsets[(packet.key >> shift) & 0xffu]++] = packet;
+            queue.swap(scratch);
+        }
+    }
+
+    // calls draw(packet) for the sorted packets of passes [firstPass, lastPass]
+    template<typename Draw>
+    void submit(unsigned int firstPass, unsigned int lastPass, Draw draw) const {
+        for (const Packet& packet: queue) {
+            unsigned int p = pass(packet.key);
+            if (p > lastPass)
+                break;
+            if (p >= firstPass)
+                draw(packet);
+        }
+    }
+
+    const std::vector<Packet>& packets() const {
+        return queue;
+    }
+
+private:
+    std::vector<Packet> queue;
+    std::vector<Packet> scratch;
+};
+
+#endif //PROJECT_BASE_RENDERQUEUE_H
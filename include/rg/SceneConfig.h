@@ -0,0 +1,101 @@
+#ifndef PROJECT_BASE_SCENECONFIG_H
+#define PROJECT_BASE_SCENECONFIG_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// scene settings that can change without recompiling, read from a config file and then
+// overridden from the command line
+struct SceneConfig {
+    unsigned int fireflies = 196;
+    unsigned int maxFireflies = 16384;  // capacity of the firefly pool, it can grow up to this while running
+    uint32_t seed = 1;  // spawn positions and movement of the fireflies
+    int threads = -1;   // threads helping the render thread with the firefly update, -1: one per extra core
+    bool gpuFireflies = false; // move the fireflies with transform feedback (GpuFireflySystem)
+    bool flocking = true;   // the CPU simulation swarms (FireflyFlock) instead of a random walk per firefly
+    bool analyticFireflies = false; // positions computed in the shaders from the time (FireflyMotion.h), no simulation
+    bool benchmark = false;
+};
+
+// the scene starts with at least one firefly (the ImGui window can take them all away later), 0 or
+// anything that isn't a number keeps the current count
+inline void setFireflyCount(const char* value, SceneConfig& config) {
+    unsigned int count = std::strtoul(value, nullptr, 10);
+    if (count == 0) {
+        std::cerr << "The firefly count has to be at least 1, not " << value << '\n';
+        return;
+    }
+    config.fireflies = count;
+}
+
+// reads "key = value" lines, everything after '#' is a comment
+inline bool loadSceneConfig(const std::string& path, SceneConfig& config) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            continue;
+        std::string key, value;
+        std::istringstream(line.substr(0, eq)) >> key;
+        std::istringstream(line.substr(eq + 1)) >> value;
+        if (key == "fireflies")
+            setFireflyCount(value.c_str(), config);
+        else if (key == "max_fireflies")
+            config.maxFireflies = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "seed")
+            config.seed = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "threads")
+            config.threads = std::atoi(value.c_str());
+        else if (key == "gpu_fireflies")
+            config.gpuFireflies = std::atoi(value.c_str()) != 0;
+        else if (key == "flocking")
+            config.flocking = std::atoi(value.c_str()) != 0;
+        else if (key == "analytic_fireflies")
+            config.analyticFireflies = std::atoi(value.c_str()) != 0;
+        else
+            std::cerr << "Unknown setting in " << path << ": " << key << '\n';
+    }
+    return true;
+}
+
+// --config <path> loads another config file, --fireflies <n> overrides the firefly count, --max-fireflies <n> the
+// pool capacity, --seed <n> the seed, --threads <n> the number of worker threads, --gpu-fireflies moves the fireflies
+// on the GPU, --flocking <0|1> switches swarming, --analytic-fireflies moves them along closed form paths in the
+// shaders, --benchmark runs the CPU benchmarks instead of the scene
+inline void parseCommandLine(int argc, char** argv, SceneConfig& config) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--benchmark") == 0) {
+            config.benchmark = true;
+        } else if (std::strcmp(argv[i], "--gpu-fireflies") == 0) {
+            config.gpuFireflies = true;
+        } else if (std::strcmp(argv[i], "--analytic-fireflies") == 0) {
+            config.analyticFireflies = true;
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--config") == 0) {
+            if (!loadSceneConfig(argv[++i], config))
+                std::cerr << "Failed to read config file: " << argv[i] << '\n';
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--fireflies") == 0) {
+            setFireflyCount(argv[++i], config);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--max-fireflies") == 0) {
+            config.maxFireflies = std::strtoul(argv[++i], nullptr, 10);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--seed") == 0) {
+            config.seed = std::strtoul(argv[++i], nullptr, 10);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--threads") == 0) {
+            config.threads = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--flocking") == 0) {
+            config.flocking = std::atoi(argv[++i]) != 0;
+        } else {
+            std::cerr << "Unknown argument: " << argv[i] << '\n';
+        }
+    }
+}
+
+#endif //PROJECT_BASE_SCENECONFIG_H
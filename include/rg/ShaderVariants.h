@@ -0,0 +1,106 @@
+#ifndef PROJECT_BASE_SHADERVARIANTS_H
+#define PROJECT_BASE_SHADERVARIANTS_H
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <learnopengl/shader.h>
+
+// source of a shader snippet, to be inserted after the #version line with the defines of a Shader
+inline std::string loadShaderSnippet(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "ERROR::SHADER::SNIPPET_NOT_SUCCESFULLY_READ " << path << '\n';
+        return std::string();
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+    return source.str() + "\n";
+}
+
+// All permutations of one vertex/fragment shader pair. Every keyword is a bit of the variant mask,
+// a variant is compiled with "#define KEYWORD" for each of its bits set, plus the constants that are
+// shared by all variants. Variants are compiled the first time they are requested and cached, so
+// state that used to be a runtime branch in the shader (bloom, how lights are picked, alpha test)
+// is resolved by the GLSL compiler instead.
+class ShaderVariants {
+public:
+    // called once for every newly compiled variant, with the variant in use, to set its static uniforms
+    std::function<void(Shader&)> onCompile;
+
+    ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath)
+            : vertexPath(vertexPath), fragmentPath(fragmentPath) {
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    // registers a keyword and returns its bit in the variant mask
+    unsigned int keyword(const std::string& name) {
+        if (keywords.size() == 32) {
+            std::cerr << "ShaderVariants: too many keywords for " << fragmentPath << '\n';
+            return 0;
+        }
+        keywords.push_back(name);
+        return 1u << (keywords.size() - 1);
+    }
+
+    // a constant defined in every variant, has to be set before the first variant is compiled
+    void define(const std::string& name, long value) {
+        if (!variants.empty())
+            std::cerr << "ShaderVariants: " << name << " defined after variants of " << fragmentPath << " were compiled\n";
+        constants += "#define " + name + " " + std::to_string(value) + "\n";
+    }
+
+    // GLSL 330 has no #include: the functions and uniforms of a snippet file shared by several shaders
+    // are pasted into every variant after the constants, has to be called before the first variant is compiled
+    void include(const std::string& path) {
+        if (!variants.empty())
+            std::cerr << "ShaderVariants: " << path << " included after variants of " << fragmentPath << " were compiled\n";
+        constants += loadShaderSnippet(path);
+    }
+
+    // returns the variant with the given keywords, compiling it on first use
+    Shader& get(unsigned int mask) {
+        auto it = variants.find(mask);
+        if (it != variants.end())
+            return *it->second;
+
+        std::string defines = constants;
+        for (unsigned int i = 0; i < keywords.size(); i++) {
+            if (mask & (1u << i))
+                defines += "#define " + keywords[i] + "\n";
+        }
+        std::unique_ptr<Shader> shader(new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines));
+        if (onCompile) {
+            shader->use();
+            onCompile(*shader);
+        }
+        return *(variants[mask] = std::move(shader));
+    }
+
+    // same as get, and makes the variant the current program
+    Shader& use(unsigned int mask) {
+        Shader& shader = get(mask);
+        shader.use();
+        return shader;
+    }
+
+    unsigned int compiledCount() const {
+        return variants.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath;
+    std::vector<std::string> keywords;
+    std::string constants;
+    std::unordered_map<unsigned int, std::unique_ptr<Shader>> variants;
+};
+
+#endif //PROJECT_BASE_SHADERVARIANTS_H
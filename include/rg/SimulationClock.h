@@ -0,0 +1,74 @@
+#ifndef PROJECT_BASE_SIMULATIONCLOCK_H
+#define PROJECT_BASE_SIMULATIONCLOCK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// Fixed rate simulation time, independent of the render frame rate. Every frame the render loop
+// hands in the wall clock and runs the ticks that have passed since the last frame; what is left
+// over (alpha) interpolates the rendered state between the last two ticks.
+// Time is accumulated in double, so long sessions don't lose precision.
+class SimulationClock {
+public:
+    // ticks run so far
+    uint64_t tick = 0;
+
+    // after a stall (loading, a breakpoint, a dragged window) at most maxTicksPerFrame are caught up,
+    // the rest of the backlog is dropped instead of making the next frames even slower
+    explicit SimulationClock(double tickRate, unsigned int maxTicksPerFrame = 8)
+            : tickLength(1.0 / tickRate), maxTicksPerFrame(maxTicksPerFrame) {
+    }
+
+    // seconds on a monotonic clock that every thread reads the same
+    static double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // number of ticks to run for a frame at `now` seconds, they are counted in `tick` right away
+    unsigned int advance(double now) {
+        if (!started) {
+            started = true;
+            last = now;
+        }
+        accumulator += now - last;
+        last = now;
+
+        // frame times that are a multiple of the tick length come out a hair short after rounding, they
+        // would run one tick less and then one more in the next frame
+        const double tolerance = tickLength * 1e-6;
+        unsigned int ticks = 0;
+        while (accumulator + tolerance >= tickLength && ticks < maxTicksPerFrame) {
+            accumulator = std::max(accumulator - tickLength, 0.0);
+            ticks++;
+        }
+        if (accumulator + tolerance >= tickLength)
+            accumulator = std::fmod(accumulator, tickLength);
+        tick += ticks;
+        return ticks;
+    }
+
+    // how far the frame is between the last tick and the next one, in [0, 1)
+    float alpha() const {
+        return (float) (accumulator / tickLength);
+    }
+
+    double tickSeconds() const {
+        return tickLength;
+    }
+
+    // when the last tick was due
+    double lastTickTime() const {
+        return last - accumulator;
+    }
+
+private:
+    double tickLength;
+    unsigned int maxTicksPerFrame;
+    double accumulator = 0.0;
+    double last = 0.0;
+    bool started = false;
+};
+
+#endif //PROJECT_BASE_SIMULATIONCLOCK_H
@@ -0,0 +1,233 @@
+#ifndef PROJECT_BASE_SPATIALHASHGRID_H
+#define PROJECT_BASE_SPATIALHASHGRID_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <rg/JobSystem.h>
+
+// Uniform grid over an unbounded space, hashed into a table of buckets. build() sorts the points
+// by bucket with a counting sort, so the points of a bucket lie next to each other: the sorted
+// copies of their coordinates (x, y, z) and their original indices (index).
+// Queries hand out contiguous ranges of those arrays. A bucket may also hold points of other cells
+// that hash to the same bucket, so callers still check the distance.
+// The sort is stable, the order of the points within a bucket (and so every query) doesn't depend
+// on the number of threads used to build it.
+// Used for the firefly neighbourhoods (FireflyFlock.h), and generic enough for picking and light lookups.
+class SpatialHashGrid {
+public:
+    // sorted by bucket
+    std::vector<float> x, y, z;
+    std::vector<unsigned int> index;
+
+    explicit SpatialHashGrid(float cellSize) : cellSize(cellSize) {
+    }
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    unsigned int size() const {
+        return index.size();
+    }
+
+    // sorts the n points into the grid. With a job system the buckets are computed, counted and
+    // scattered in parallel, one part of the points per thread.
+    void build(const float* px, const float* py, const float* pz, unsigned int n, JobSystem* jobs = nullptr) {
+        // at least as many buckets as points, a power of two to mask the hash. Queries take rows of 3
+        // cells, which only wrap around the table once if it has more buckets than that.
+        unsigned int buckets = 4;
+        while (buckets < n)
+            buckets *= 2;
+        mask = buckets - 1;
+        bucketStart.assign(buckets + 1, 0);
+        bucketOf.resize(n);
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        index.resize(n);
+        if (n == 0)
+            return;
+
+        unsigned int parts = jobs ? std::max(1u, std::min(jobs->threadCount(), n / MinPointsPerPart)) : 1;
+        unsigned int grain = (n + parts - 1) / parts;
+        // every part zeroes its own counters, so there have to be exactly as many parts as chunks of points
+        parts = (n + grain - 1) / grain;
+        counts.resize((size_t) parts * buckets);
+
+        // 1. bucket of every point, counted per part
+        forParts(jobs, n, grain, [this, px, py, pz, grain, buckets](unsigned int begin, unsigned int end) {
+            unsigned int* partCounts = &counts[(size_t) (begin / grain) * buckets];
+            std::fill(partCounts, partCounts + buckets, 0u);
+            for (unsigned int i = begin; i < end; i++) {
+                bucketOf[i] = bucket(cell(px[i]), cell(py[i]), cell(pz[i]));
+                partCounts[bucketOf[i]]++;
+            }
+        });
+
+        // 2. where every part's points of every bucket go: buckets in order, the parts of a bucket in order.
+        // The table has parts * buckets counters, so the prefix sum is split as well: every range of
+        // buckets adds up its points, the ranges get their offsets, then every range hands out its slots.
+        unsigned int bucketGrain = (buckets + parts - 1) / parts;
+        rangeOffsets.resize(parts);
+        forParts(jobs, buckets, bucketGrain, [this, parts, bucketGrain, buckets](unsigned int begin, unsigned int end) {
+            unsigned int total = 0;
+            for (unsigned int part = 0; part < parts; part++) {
+                const unsigned int* partCounts = &counts[(size_t) part * buckets];
+                for (unsigned int b = begin; b < end; b++)
+                    total += partCounts[b];
+            }
+            rangeOffsets[begin / bucketGrain] = total;
+        });
+        unsigned int offset = 0;
+        for (unsigned int range = 0; range * bucketGrain < buckets; range++) {
+            unsigned int total = rangeOffsets[range];
+            rangeOffsets[range] = offset;
+            offset += total;
+        }
+        bucketStart[buckets] = offset;
+        forParts(jobs, buckets, bucketGrain, [this, parts, bucketGrain, buckets](unsigned int begin, unsigned int end) {
+            unsigned int offset = rangeOffsets[begin / bucketGrain];
+            for (unsigned int b = begin; b < end; b++) {
+                bucketStart[b] = offset;
+                for (unsigned int part = 0; part < parts; part++) {
+                    unsigned int& count = counts[(size_t) part * buckets + b];
+                    unsigned int partCount = count;
+                    count = offset;
+                    offset += partCount;
+                }
+            }
+        });
+
+        // 3. scatter, every part fills its own slots
+        forParts(jobs, n, grain, [this, px, py, pz, grain, buckets](unsigned int begin, unsigned int end) {
+            unsigned int* partOffsets = &counts[(size_t) (begin / grain) * buckets];
+            for (unsigned int i = begin; i < end; i++) {
+                unsigned int k = partOffsets[bucketOf[i]]++;
+                x[k] = px[i];
+                y[k] = py[i];
+                z[k] = pz[i];
+                index[k] = i;
+            }
+        });
+    }
+
+    // a run of sorted points, [begin, end)
+    struct Range {
+        unsigned int begin, end;
+    };
+
+    static const unsigned int MaxRanges = 18;
+
+    glm::ivec3 cellOf(const glm::vec3& p) const {
+        return glm::ivec3(cell(p.x), cell(p.y), cell(p.z));
+    }
+
+    // the points of the 3 x 3 x 3 cells around `c` (and of the cells sharing their buckets), every
+    // point within the cell size of any point in the cell. Returns the number of ranges written, at
+    // most MaxRanges. Points of the same cell share the result, callers walking the points in grid
+    // order only need a new one when the cell changes.
+    unsigned int neighbourhood(const glm::ivec3& c, Range* ranges) const {
+        return collect(c - glm::ivec3(1), c + glm::ivec3(1), ranges);
+    }
+
+    // calls f(begin, end) with the range of every bucket that may hold points within `radius` of p,
+    // each bucket once. The radius is at most the cell size.
+    template<typename F>
+    void query(const glm::vec3& p, float radius, F f) const {
+        radius = std::min(radius, cellSize);
+        Range ranges[MaxRanges];
+        unsigned int count = collect(cellOf(p - glm::vec3(radius)), cellOf(p + glm::vec3(radius)), ranges);
+        for (unsigned int r = 0; r < count; r++)
+            f(ranges[r].begin, ranges[r].end);
+    }
+
+    // original index of the point closest to p within maxDistance (at most the cell size), or -1
+    int nearest(const glm::vec3& p, float maxDistance) const {
+        int best = -1;
+        float bestDistance2 = maxDistance * maxDistance;
+        query(p, maxDistance, [this, &p, &best, &bestDistance2](unsigned int begin, unsigned int end) {
+            for (unsigned int k = begin; k < end; k++) {
+                glm::vec3 d = glm::vec3(x[k], y[k], z[k]) - p;
+                float distance2 = glm::dot(d, d);
+                if (distance2 <= bestDistance2 && (distance2 < bestDistance2 || best < 0 || (int) index[k] < best)) {
+                    bestDistance2 = distance2;
+                    best = index[k];
+                }
+            }
+        });
+        return best;
+    }
+
+private:
+    // smaller parts aren't worth a thread
+    static const unsigned int MinPointsPerPart = 2048;
+
+    float cellSize;
+    unsigned int mask = 0;
+    std::vector<unsigned int> bucketStart;  // bucket b holds the sorted points [bucketStart[b], bucketStart[b + 1])
+    std::vector<unsigned int> bucketOf;     // per input point
+    std::vector<unsigned int> counts;       // per part and bucket: points, then the next free slot
+    std::vector<unsigned int> rangeOffsets; // per range of buckets of the prefix sum: points, then the first slot
+
+    // ranges of the buckets of the cells in [lo, hi], at most 3 per axis. A row of cells along x lies
+    // in consecutive buckets, so it is one range, and overlapping rows (cells sharing a bucket) are merged.
+    unsigned int collect(const glm::ivec3& lo, const glm::ivec3& hi, Range* ranges) const {
+        if (index.empty())
+            return 0;
+        // bucket intervals [first, last) of the rows, split where they wrap around, sorted by first
+        const unsigned int buckets = mask + 1, width = hi.x - lo.x + 1;
+        Range rows[18];
+        unsigned int nRows = 0;
+        for (int cz = lo.z; cz <= hi.z; cz++) {
+            for (int cy = lo.y; cy <= hi.y; cy++) {
+                unsigned int first = bucket(lo.x, cy, cz);
+                if (first + width <= buckets) {
+                    insertSorted(rows, nRows, {first, first + width});
+                } else {
+                    insertSorted(rows, nRows, {first, buckets});
+                    insertSorted(rows, nRows, {0, first + width - buckets});
+                }
+            }
+        }
+        unsigned int count = 0;
+        for (unsigned int r = 0; r < nRows; r++) {
+            unsigned int first = rows[r].begin, last = rows[r].end;
+            while (r + 1 < nRows && rows[r + 1].begin <= last)
+                last = std::max(last, rows[++r].end);
+            if (bucketStart[first] < bucketStart[last])
+                ranges[count++] = {bucketStart[first], bucketStart[last]};
+        }
+        return count;
+    }
+
+    static void insertSorted(Range* rows, unsigned int& n, const Range& row) {
+        unsigned int r = n++;
+        for (; r > 0 && rows[r - 1].begin > row.begin; r--)
+            rows[r] = rows[r - 1];
+        rows[r] = row;
+    }
+
+    int cell(float v) const {
+        return (int) std::floor(v / cellSize);
+    }
+
+    // rows along x are hashed, the cells of a row follow each other
+    unsigned int bucket(int cx, int cy, int cz) const {
+        return (((uint32_t) cy * 73856093u ^ (uint32_t) cz * 19349663u) + (uint32_t) cx) & mask;
+    }
+
+    template<typename F>
+    static void forParts(JobSystem* jobs, unsigned int n, unsigned int grain, const F& body) {
+        if (jobs)
+            jobs->parallelFor(0, n, grain, body);
+        else
+            body(0, n);
+    }
+};
+
+#endif //PROJECT_BASE_SPATIALHASHGRID_H
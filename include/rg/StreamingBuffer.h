@@ -0,0 +1,208 @@
+#ifndef PROJECT_BASE_STREAMINGBUFFER_H
+#define PROJECT_BASE_STREAMINGBUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+// ARB_buffer_storage, the glad loader in libs/ is generated without extensions
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// A ring of GPU memory for data written once per frame (instance attributes and the like). Every
+// allocation gets the next aligned bytes of one big buffer, written through a mapping that never
+// synchronizes with the driver: with GL_MAP_UNSYNCHRONIZED_BIT, or persistently mapped when the
+// context has ARB_buffer_storage and its entry point was loaded with loadBufferStorage(). The ranges
+// used in a frame are guarded by a fence at the end of the frame and the ring only waits on that
+// fence when it comes around to those bytes again, so it has to hold a few frames' worth of data.
+// Users point their attributes at Allocation::offset of buffer().
+class StreamingBuffer {
+public:
+    struct Allocation {
+        void* data = nullptr;   // null if the request didn't fit
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+
+    typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+    // glBufferStorage through the loader, only if the context has ARB_buffer_storage (e.g.
+    // glfwExtensionSupported). Buffers made afterwards are persistently mapped.
+    static void loadBufferStorage(GLADloadproc load) {
+        bufferStorage() = (BufferStorageProc) load("glBufferStorage");
+    }
+
+    StreamingBuffer(GLenum target, GLsizeiptr capacity) : target(target), capacity(capacity) {
+        glGenBuffers(1, &id);
+        glBindBuffer(target, id);
+        if (bufferStorage()) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage()(target, capacity, nullptr, flags);
+            mapped = (char*) glMapBufferRange(target, 0, capacity, flags);
+            if (!mapped) {
+                // the storage can't be changed any more, the fallback needs a buffer of its own
+                glDeleteBuffers(1, &id);
+                glGenBuffers(1, &id);
+                glBindBuffer(target, id);
+            }
+        }
+        if (!mapped)
+            glBufferData(target, capacity, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+    }
+
+    ~StreamingBuffer() {
+        while (!regions.empty())
+            release(regions.front().fence);
+        if (mapped) {
+            glBindBuffer(target, id);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+        }
+        glDeleteBuffers(1, &id);
+    }
+
+    StreamingBuffer(const StreamingBuffer&) = delete;
+    StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+
+    unsigned int buffer() const {
+        return id;
+    }
+
+    bool persistent() const {
+        return mapped != nullptr;
+    }
+
+    // times the ring had to wait for the GPU to finish with the bytes it came around to
+    unsigned int stalls() const {
+        return stallCount;
+    }
+
+    // maps `size` bytes at the next multiple of `alignment`, to be written and then handed back with
+    // commit() before anything else is allocated or drawn from them
+    Allocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16) {
+        Allocation allocation;
+        GLintptr offset = (head + alignment - 1) / alignment * alignment;
+        // the rest of the ring is skipped when the request doesn't fit before its end
+        if (offset + size > capacity)
+            offset = 0;
+        GLsizeiptr taken = (offset >= head ? offset - head : capacity - head + offset) + size;
+        if (frameBytes + taken > capacity) {
+            std::cerr << "StreamingBuffer of " << capacity << " bytes can't hold " << size << " more bytes this frame\n";
+            return allocation;
+        }
+        frameBytes += taken;
+        waitFor(offset, offset + size);
+        if (open.empty() || open.back().end != offset)
+            open.push_back({offset, offset + size, nullptr});
+        else
+            open.back().end = offset + size;
+        head = offset + size;
+
+        allocation.offset = offset;
+        allocation.size = size;
+        if (mapped) {
+            allocation.data = mapped + offset;
+        } else {
+            glBindBuffer(target, id);
+            allocation.data = glMapBufferRange(target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+                                                                     | GL_MAP_INVALIDATE_RANGE_BIT);
+            glBindBuffer(target, 0);
+        }
+        return allocation;
+    }
+
+    void commit(const Allocation& allocation) {
+        // a coherent persistent mapping is visible to the next draw as it is
+        if (mapped || !allocation.data)
+            return;
+        glBindBuffer(target, id);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+    }
+
+    // allocate, copy and commit in one go
+    Allocation upload(const void* data, GLsizeiptr size, GLsizeiptr alignment = 16) {
+        Allocation allocation = allocate(size, alignment);
+        if (allocation.data) {
+            std::memcpy(allocation.data, data, size);
+            commit(allocation);
+        }
+        return allocation;
+    }
+
+    // after the last draw that reads this frame's allocations: fences them
+    void endFrame() {
+        if (!open.empty()) {
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            for (Region& region: open) {
+                region.fence = fence;
+                regions.push_back(region);
+            }
+            open.clear();
+        }
+        frameBytes = 0;
+    }
+
+private:
+    // bytes [begin, end) read by the draws before `fence`
+    struct Region {
+        GLintptr begin;
+        GLintptr end;
+        GLsync fence;
+    };
+
+    GLenum target;
+    GLsizeiptr capacity;
+    unsigned int id = 0;
+    char* mapped = nullptr;
+    GLintptr head = 0;
+    GLsizeiptr frameBytes = 0;      // taken since the last endFrame, wasted alignment and wrap included
+    std::vector<Region> open;       // this frame's, not fenced yet
+    std::deque<Region> regions;     // oldest first
+    unsigned int stallCount = 0;
+
+    static BufferStorageProc& bufferStorage() {
+        static BufferStorageProc proc = nullptr;
+        return proc;
+    }
+
+    // waits until the GPU is done with every fenced region overlapping [begin, end). Fences signal in
+    // order, so everything older goes as well.
+    void waitFor(GLintptr begin, GLintptr end) {
+        size_t last = regions.size();
+        for (size_t i = 0; i < regions.size(); i++) {
+            if (regions[i].begin < end && begin < regions[i].end)
+                last = i;
+        }
+        if (last == regions.size())
+            return;
+        GLsync fence = regions[last].fence;
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            stallCount++;
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        }
+        while (regions.front().fence != fence)
+            release(regions.front().fence);
+        release(fence);
+    }
+
+    // drops the oldest regions, all of them guarded by `fence`, and the fence
+    void release(GLsync fence) {
+        while (!regions.empty() && regions.front().fence == fence)
+            regions.pop_front();
+        glDeleteSync(fence);
+    }
+};
+
+#endif //PROJECT_BASE_STREAMINGBUFFER_H
@@ -0,0 +1,444 @@
+#ifndef PROJECT_BASE_TRIANGLEBVH_H
+#define PROJECT_BASE_TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Bounding volume hierarchy over the triangles of a model, in model space, for collisions and picking
+// on the CPU. Built top down with the surface area heuristic over binned centroids. The nodes are
+// flattened depth first into one array of 32 byte nodes (two per cache line): the left child of an
+// interior node is the next node, only the right one is stored. The triangles are reordered so every
+// leaf is a contiguous run of them, kept as a vertex and two edges, ready for the intersection test.
+class TriangleBVH {
+public:
+    struct Node {
+        glm::vec3 boundsMin;
+        unsigned int first;     // leaf: first triangle, interior: right child
+        glm::vec3 boundsMax;
+        unsigned int count;     // leaf: number of triangles, interior: 0
+    };
+
+    struct Triangle {
+        glm::vec3 v0, e1, e2;   // v1 = v0 + e1, v2 = v0 + e2
+    };
+
+    struct Hit {
+        float t;                // along the ray's direction, the fraction of a segment
+        unsigned int triangle;  // in the order the triangles were added, Miss if nothing was hit
+        glm::vec3 normal;       // normalized, facing the ray
+    };
+
+    static const unsigned int Miss = ~0u;
+
+    // adds the triangles of an indexed mesh (anything with a Position per vertex), call build() after
+    template<typename V>
+    void addMesh(const std::vector<V>& vertices, const std::vector<unsigned int>& indices) {
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            addTriangle(vertices[indices[i]].Position, vertices[indices[i + 1]].Position,
+                        vertices[indices[i + 2]].Position);
+    }
+
+    void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        triangles.push_back({a, b - a, c - a});
+        source.push_back(source.size());
+    }
+
+    unsigned int triangleCount() const {
+        return triangles.size();
+    }
+
+    unsigned int nodeCount() const {
+        return nodes.size();
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    glm::vec3 boundsMin() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMin;
+    }
+
+    glm::vec3 boundsMax() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMax;
+    }
+
+    // builds the hierarchy over all triangles added so far
+    void build() {
+        unsigned int n = triangles.size();
+        nodes.clear();
+        if (n == 0)
+            return;
+        nodes.reserve(2 * n);
+        centroids.resize(n);
+        order.resize(n);
+        for (unsigned int i = 0; i < n; i++) {
+            const Triangle& t = triangles[i];
+            centroids[i] = t.v0 + (t.e1 + t.e2) * (1.0f / 3.0f);
+            order[i] = i;
+        }
+        nodes.push_back(Node());
+        subdivide(0, 0, n);
+        nodes.shrink_to_fit();
+
+        // the triangles in leaf order
+        std::vector<Triangle> sorted(n);
+        std::vector<unsigned int> sortedSource(n);
+        for (unsigned int i = 0; i < n; i++) {
+            sorted[i] = triangles[order[i]];
+            sortedSource[i] = source[order[i]];
+        }
+        triangles.swap(sorted);
+        source.swap(sortedSource);
+        centroids.clear();
+        centroids.shrink_to_fit();
+        order.clear();
+        order.shrink_to_fit();
+    }
+
+    // closest hit along origin + t * direction for t in (0, tMax)
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit) const {
+        hit.t = tMax;
+        hit.triangle = Miss;
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse = reciprocal(direction);
+
+        unsigned int stack[MaxDepth];
+        unsigned int top = 0;
+        unsigned int node = 0;
+        if (!slabs(nodes[0], origin, inverse, hit.t))
+            return false;
+        unsigned int best = Miss;
+        while (true) {
+            const Node& current = nodes[node];
+            if (current.count > 0) {
+                for (unsigned int i = current.first; i < current.first + current.count; i++) {
+                    if (intersectTriangle(triangles[i], origin, direction, hit.t))
+                        best = i;
+                }
+            } else {
+                // nearer child first, the other one later if it's still in front of the closest hit
+                unsigned int left = node + 1, right = current.first;
+                float tLeft = slabs(nodes[left], origin, inverse, hit.t);
+                float tRight = slabs(nodes[right], origin, inverse, hit.t);
+                if (tLeft > 0.0f && tRight > 0.0f) {
+                    if (tRight < tLeft)
+                        std::swap(left, right);
+                    stack[top++] = right;
+                    node = left;
+                    continue;
+                }
+                if (tLeft > 0.0f || tRight > 0.0f) {
+                    node = tLeft > 0.0f ? left : right;
+                    continue;
+                }
+            }
+            // next pending node that isn't behind the closest hit
+            bool found = false;
+            while (top > 0 && !found) {
+                node = stack[--top];
+                found = slabs(nodes[node], origin, inverse, hit.t) > 0.0f;
+            }
+            if (!found)
+                break;
+        }
+        if (best == Miss)
+            return false;
+        setHit(best, direction, hit);
+        return true;
+    }
+
+    // batch of segments from[i] -> to[i], hits[i].t is the fraction of the segment where it hits. Returns
+    // the number of segments that hit something. Meant for segments that are short next to the triangles
+    // (a firefly's step): nodes are culled by the segment's bounding box, no slab tests and no ordering.
+    unsigned int intersectSegments(const glm::vec3* from, const glm::vec3* to, unsigned int n, Hit* hits) const {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < n; i++)
+            count += intersectSegment(from[i], to[i], hits[i]);
+        return count;
+    }
+
+    // whether any triangle is within `radius` of center
+    bool overlapsSphere(const glm::vec3& center, float radius) const {
+        if (nodes.empty())
+            return false;
+        const float radius2 = radius * radius;
+        unsigned int stack[MaxDepth];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            glm::vec3 d = glm::clamp(center, node.boundsMin, node.boundsMax) - center;
+            if (glm::dot(d, d) > radius2)
+                continue;
+            if (node.count > 0) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    glm::vec3 offset = closestPoint(triangles[i], center) - center;
+                    if (glm::dot(offset, offset) <= radius2)
+                        return true;
+                }
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = &node - nodes.data() + 1;
+            }
+        }
+        return false;
+    }
+
+private:
+    // leaves with fewer triangles are never split, leaves with more are always split
+    static const unsigned int MinLeafTriangles = 2;
+    static const unsigned int MaxLeafTriangles = 16;
+    static const unsigned int Bins = 16;
+    // with the median split fallback the depth is at most log2 of the triangle count plus the SAH levels
+    static const unsigned int MaxDepth = 64;
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<unsigned int> source;       // index of every triangle as added
+    // while building
+    std::vector<glm::vec3> centroids;
+    std::vector<unsigned int> order;
+
+    struct Bounds {
+        glm::vec3 lo = glm::vec3(1e30f), hi = glm::vec3(-1e30f);
+
+        void grow(const glm::vec3& p) {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+
+        void grow(const Bounds& b) {
+            lo = glm::min(lo, b.lo);
+            hi = glm::max(hi, b.hi);
+        }
+
+        float area() const {
+            glm::vec3 e = glm::max(hi - lo, glm::vec3(0.0f));
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+    };
+
+    Bounds triangleBounds(unsigned int i) const {
+        const Triangle& t = triangles[i];
+        Bounds b;
+        b.grow(t.v0);
+        b.grow(t.v0 + t.e1);
+        b.grow(t.v0 + t.e2);
+        return b;
+    }
+
+    // makes nodes[node] a leaf or an interior node over order[begin, end)
+    void subdivide(unsigned int node, unsigned int begin, unsigned int end, unsigned int depth = 1) {
+        Bounds bounds, centroidBounds;
+        for (unsigned int i = begin; i < end; i++) {
+            bounds.grow(triangleBounds(order[i]));
+            centroidBounds.grow(centroids[order[i]]);
+        }
+        nodes[node].boundsMin = bounds.lo;
+        nodes[node].boundsMax = bounds.hi;
+        unsigned int count = end - begin;
+
+        unsigned int mid = begin;
+        if (count > MinLeafTriangles && depth < MaxDepth - 1) {
+            // cheapest bin boundary over all axes, costs relative to intersecting one triangle
+            float bestCost = 1e30f;
+            int bestAxis = -1;
+            unsigned int bestBin = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                float lo = centroidBounds.lo[axis], extent = centroidBounds.hi[axis] - lo;
+                if (extent <= 0.0f)
+                    continue;
+                Bounds bins[Bins];
+                unsigned int counts[Bins] = {};
+                float scale = Bins / extent;
+                for (unsigned int i = begin; i < end; i++) {
+                    unsigned int b = binOf(centroids[order[i]][axis], lo, scale);
+                    counts[b]++;
+                    bins[b].grow(triangleBounds(order[i]));
+                }
+                // areas and counts right of every boundary, then sweep from the left
+                float rightArea[Bins];
+                unsigned int rightCount[Bins];
+                Bounds right;
+                unsigned int inRight = 0;
+                for (unsigned int b = Bins - 1; b > 0; b--) {
+                    right.grow(bins[b]);
+                    inRight += counts[b];
+                    rightArea[b] = right.area();
+                    rightCount[b] = inRight;
+                }
+                Bounds left;
+                unsigned int inLeft = 0;
+                for (unsigned int b = 1; b < Bins; b++) {
+                    left.grow(bins[b - 1]);
+                    inLeft += counts[b - 1];
+                    if (inLeft == 0 || rightCount[b] == 0)
+                        continue;
+                    float cost = left.area() * inLeft + rightArea[b] * rightCount[b];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            // one traversal step against testing all triangles of the node
+            float leafCost = bounds.area() * count;
+            if (bestAxis >= 0 && (bestCost + bounds.area() < leafCost || count > MaxLeafTriangles)) {
+                float lo = centroidBounds.lo[bestAxis];
+                float scale = Bins / (centroidBounds.hi[bestAxis] - lo);
+                mid = std::partition(order.begin() + begin, order.begin() + end, [this, bestAxis, bestBin, lo, scale](unsigned int i) {
+                    return binOf(centroids[i][bestAxis], lo, scale) < bestBin;
+                }) - order.begin();
+            } else if (count > MaxLeafTriangles) {
+                // all centroids in one spot, halves by index
+                mid = begin + count / 2;
+            }
+        }
+
+        if (mid == begin) {
+            nodes[node].first = begin;
+            nodes[node].count = count;
+            return;
+        }
+        nodes[node].count = 0;
+        nodes.push_back(Node());
+        subdivide(node + 1, begin, mid, depth + 1);
+        unsigned int right = nodes.size();
+        nodes[node].first = right;
+        nodes.push_back(Node());
+        subdivide(right, mid, end, depth + 1);
+    }
+
+    bool intersectSegment(const glm::vec3& from, const glm::vec3& to, Hit& hit) const {
+        hit.t = 1.0f;
+        hit.triangle = Miss;
+        glm::vec3 lo = glm::min(from, to), hi = glm::max(from, to), direction = to - from;
+        if (nodes.empty() || !overlaps(nodes[0], lo, hi))
+            return false;
+        unsigned int stack[MaxDepth];
+        unsigned int top = 0;
+        unsigned int node = 0;
+        unsigned int best = Miss;
+        while (true) {
+            const Node& current = nodes[node];
+            if (current.count > 0) {
+                for (unsigned int i = current.first; i < current.first + current.count; i++) {
+                    if (intersectTriangle(triangles[i], from, direction, hit.t))
+                        best = i;
+                }
+            } else {
+                // children are tested before going down, the stack only holds boxes the segment touches
+                bool left = overlaps(nodes[node + 1], lo, hi), right = overlaps(nodes[current.first], lo, hi);
+                if (left && right)
+                    stack[top++] = current.first;
+                if (left || right) {
+                    node = left ? node + 1 : current.first;
+                    continue;
+                }
+            }
+            if (top == 0)
+                break;
+            node = stack[--top];
+        }
+        if (best == Miss)
+            return false;
+        setHit(best, direction, hit);
+        return true;
+    }
+
+    static bool overlaps(const Node& node, const glm::vec3& lo, const glm::vec3& hi) {
+        return lo.x <= node.boundsMax.x && hi.x >= node.boundsMin.x && lo.y <= node.boundsMax.y &&
+               hi.y >= node.boundsMin.y && lo.z <= node.boundsMax.z && hi.z >= node.boundsMin.z;
+    }
+
+    void setHit(unsigned int triangle, const glm::vec3& direction, Hit& hit) const {
+        const Triangle& t = triangles[triangle];
+        glm::vec3 normal = glm::normalize(glm::cross(t.e1, t.e2));
+        hit.normal = glm::dot(normal, direction) > 0.0f ? -normal : normal;
+        hit.triangle = source[triangle];
+    }
+
+    static unsigned int binOf(float centroid, float lo, float scale) {
+        return std::min((unsigned int) ((centroid - lo) * scale), Bins - 1);
+    }
+
+    // axes the direction doesn't move along get a huge reciprocal instead of an infinite one, so a ray
+    // in a slab's plane doesn't produce 0 * inf
+    static glm::vec3 reciprocal(const glm::vec3& d) {
+        glm::vec3 r;
+        for (int axis = 0; axis < 3; axis++)
+            r[axis] = 1.0f / (std::fabs(d[axis]) > 1e-20f ? d[axis] : std::copysign(1e-20f, d[axis]));
+        return r;
+    }
+
+    // where the ray enters the node's box plus one, 0 if it misses the box within (0, tMax)
+    static float slabs(const Node& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax) {
+        glm::vec3 t0 = (node.boundsMin - origin) * inverse;
+        glm::vec3 t1 = (node.boundsMax - origin) * inverse;
+        glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+        float tNear = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        float tFar = std::min(std::min(far.x, far.y), std::min(far.z, tMax));
+        return tNear <= tFar ? tNear + 1.0f : 0.0f;
+    }
+
+    // Möller-Trumbore, both sides, shortens t on a hit in (0, t)
+    static bool intersectTriangle(const Triangle& tri, const glm::vec3& origin, const glm::vec3& direction, float& t) {
+        glm::vec3 p = glm::cross(direction, tri.e2);
+        float det = glm::dot(tri.e1, p);
+        if (std::fabs(det) < 1e-12f)
+            return false;
+        float inverseDet = 1.0f / det;
+        glm::vec3 s = origin - tri.v0;
+        float u = glm::dot(s, p) * inverseDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, tri.e1);
+        float v = glm::dot(direction, q) * inverseDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        float distance = glm::dot(tri.e2, q) * inverseDet;
+        if (distance <= 0.0f || distance >= t)
+            return false;
+        t = distance;
+        return true;
+    }
+
+    // closest point of the triangle to p (Real-Time Collision Detection, 5.1.5)
+    static glm::vec3 closestPoint(const Triangle& tri, const glm::vec3& p) {
+        const glm::vec3& a = tri.v0;
+        const glm::vec3& ab = tri.e1;
+        const glm::vec3& ac = tri.e2;
+        glm::vec3 ap = p - a;
+        float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return a;
+        glm::vec3 bp = ap - ab;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+            return a + ab;
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return a + ab * (d1 / (d1 - d3));
+        glm::vec3 cp = ap - ac;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+            return a + ac;
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return a + ac * (d2 / (d2 - d6));
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+            return a + ab + (ac - ab) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        float denominator = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+};
+
+#endif //PROJECT_BASE_TRIANGLEBVH_H
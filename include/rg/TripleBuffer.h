@@ -0,0 +1,107 @@
+#ifndef PROJECT_BASE_TRIPLEBUFFER_H
+#define PROJECT_BASE_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Lock-free hand over of snapshots from one writer thread to one reader thread. The writer fills
+// the back buffer and publishes it, the reader takes the newest published buffer as its front one.
+// Neither side ever waits for the other: publishing swaps the back buffer with the middle one and
+// reading swaps the middle one with the front one, both with a single atomic exchange. A buffer is
+// only ever touched by the side that owns it, so the reader never sees a half written snapshot.
+template<typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+
+    explicit TripleBuffer(const T& initial) : buffers{initial, initial, initial} {
+    }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // writer: the buffer to fill next, it may still hold an old snapshot
+    T& back() {
+        return buffers[backIndex];
+    }
+
+    // writer: makes the back buffer the newest snapshot and gets another one to fill
+    void publish() {
+        backIndex = middle.exchange(backIndex | Fresh, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // reader: switches to the newest snapshot if one was published since the last call
+    bool update() {
+        if (!(middle.load(std::memory_order_acquire) & Fresh))
+            return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    // reader: the snapshot taken by the last update
+    const T& front() const {
+        return buffers[frontIndex];
+    }
+
+private:
+    // the middle index carries a flag telling whether it was published after the reader last looked
+    static const unsigned int IndexMask = 3;
+    static const unsigned int Fresh = 4;
+
+    T buffers[3];
+    unsigned int backIndex = 0;             // writer only
+    unsigned int frontIndex = 1;            // reader only
+    std::atomic<unsigned int> middle{2};
+};
+
+// stress test of the hand over (--benchmark): a writer publishes snapshots as fast as it can, every
+// value of a snapshot derived from its sequence number, while a reader checks every snapshot it gets
+// for values of another sequence (torn reads) and for sequences going backwards. Returns false on errors.
+inline bool stressTripleBuffer(std::ostream& out, double seconds = 1.0) {
+    struct Snapshot {
+        uint64_t sequence = 0;
+        std::vector<uint64_t> values = std::vector<uint64_t>(4096, 0);
+    };
+    TripleBuffer<Snapshot> buffer;
+    std::atomic<bool> done(false);
+    std::thread writer([&buffer, &done] {
+        for (uint64_t sequence = 1; !done.load(std::memory_order_relaxed); sequence++) {
+            Snapshot& snapshot = buffer.back();
+            snapshot.sequence = sequence;
+            for (size_t i = 0; i < snapshot.values.size(); i++)
+                snapshot.values[i] = sequence * 0x9e3779b97f4a7c15ull + i;
+            buffer.publish();
+        }
+    });
+
+    uint64_t reads = 0, torn = 0, backwards = 0, last = 0;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    while (std::chrono::steady_clock::now() < end) {
+        if (!buffer.update())
+            continue;
+        const Snapshot& snapshot = buffer.front();
+        for (size_t i = 0; i < snapshot.values.size(); i++) {
+            if (snapshot.values[i] != snapshot.sequence * 0x9e3779b97f4a7c15ull + i) {
+                torn++;
+                break;
+            }
+        }
+        if (snapshot.sequence < last)
+            backwards++;
+        last = snapshot.sequence;
+        reads++;
+    }
+    done = true;
+    writer.join();
+
+    out << "triple buffer: " << reads << " snapshots read of " << last << " published, "
+        << torn << " torn, " << backwards << " out of order\n";
+    return torn == 0 && backwards == 0;
+}
+
+#endif //PROJECT_BASE_TRIPLEBUFFER_H
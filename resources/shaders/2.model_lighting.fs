@@ -32,13 +32,64 @@ in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
 
-#define MAX_N_POINT_LIGHTS 512
 uniform Material material;
 uniform DirLight dirLight;
-uniform int nPointLights;
-uniform PointLight pointLight[MAX_N_POINT_LIGHTS];
+uniform samplerBuffer pointLightPositions;  // xyz: position, unused with ANALYTIC_FIREFLIES
+uniform samplerBuffer pointLightProperties; // 3 texels per light: ambient + constant, diffuse + linear, specular + quadratic
+uniform int nPointLights;                   // live lights, the buffers hold up to the pool capacity
+
+PointLight fetchPointLight(int i)
+{
+    PointLight light;
+#ifdef ANALYTIC_FIREFLIES
+    light.position = fireflyMotion(uint(i));
+#else
+    light.position = texelFetch(pointLightPositions, i).xyz;
+#endif
+    vec4 ambient = texelFetch(pointLightProperties, 3 * i);
+    vec4 diffuse = texelFetch(pointLightProperties, 3 * i + 1);
+    vec4 specular = texelFetch(pointLightProperties, 3 * i + 2);
+    light.ambient = ambient.rgb;
+    light.diffuse = diffuse.rgb;
+    light.specular = specular.rgb;
+    light.constant = ambient.a;
+    light.linear = diffuse.a;
+    light.quadratic = specular.a;
+    return light;
+}
 
 uniform vec3 viewPosition;
+uniform mat4 view;
+
+// variant keywords and constants, defined by the renderer (see ShaderVariants):
+//  LIGHTS_PER_MESH, LIGHTS_CLUSTERED, LIGHTS_TREE - how point lights are picked for a fragment, all of them if none is defined
+//  ALPHA_TEST - discard transparent texels
+//  ANALYTIC_FIREFLIES - light positions from fireflyMotion (firefly_motion.glsl) instead of the light buffer
+//  MAX_MESH_LIGHTS, CLUSTER_TILES_X/Y, CLUSTER_SLICES, LIGHT_TREE_DEPTH
+
+#if defined(LIGHTS_PER_MESH)
+// per-mesh light lists, set for every draw
+uniform int nMeshLights;    // -1 when more than MAX_MESH_LIGHTS lights touch the mesh
+uniform int meshLights[MAX_MESH_LIGHTS];
+#elif defined(LIGHTS_CLUSTERED)
+uniform usamplerBuffer clusterRanges;       // per cluster: first index, light count
+uniform usamplerBuffer clusterLightIndices;
+uniform vec2 clusterTileSize;
+uniform float clusterNear;
+uniform float clusterSliceScale;            // CLUSTER_SLICES / log(far / near)
+
+int findCluster(vec3 fragPos)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = clamp(int(floor(log(depth / clusterNear) * clusterSliceScale)), 0, CLUSTER_SLICES - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    return tile.x + CLUSTER_TILES_X * (tile.y + CLUSTER_TILES_Y * slice);
+}
+#elif defined(LIGHTS_TREE)
+uniform samplerBuffer lightTreeNodes;       // 5 texels per node, see LightTree
+uniform float lightTreeErrorBound;          // largest contribution a node may have and still be shaded as one light
+#endif
+
 // calculates the color when using a point light.
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 TexColor)
 {
@@ -61,6 +112,46 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     return (ambient + diffuse + specular);
 }
 
+#ifdef LIGHTS_TREE
+// walks the light tree from the root, shading a node's virtual light as soon as the node's upper bound on
+// its contribution is below lightTreeErrorBound (LIGHT_TREE_DEPTH + 1 entries are enough for a balanced tree)
+vec3 CalcLightTree(vec3 normal, vec3 fragPos, vec3 viewDir, vec4 TexColor)
+{
+    vec3 result = vec3(0.0);
+    int stack[LIGHT_TREE_DEPTH + 1];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        int node = stack[--top];
+        vec4 boxMin = texelFetch(lightTreeNodes, 5 * node);
+        vec4 boxMax = texelFetch(lightTreeNodes, 5 * node + 1);
+        if(boxMin.w < 0.0){
+            // leaf, a single light
+            result += CalcPointLight(fetchPointLight(int(-boxMin.w) - 1), normal, fragPos, viewDir, TexColor);
+            continue;
+        }
+        vec4 ambient = texelFetch(lightTreeNodes, 5 * node + 2);
+        vec4 diffuse = texelFetch(lightTreeNodes, 5 * node + 3);
+        vec4 specular = texelFetch(lightTreeNodes, 5 * node + 4);
+        // no light of the subtree is closer than the box, or attenuates less than the smallest terms
+        float distance = length(max(max(boxMin.xyz - fragPos, fragPos - boxMax.xyz), 0.0));
+        vec3 intensity = ambient.rgb + diffuse.rgb + specular.rgb;
+        float bound = max(intensity.r, max(intensity.g, intensity.b)) / (ambient.a + diffuse.a * distance + specular.a * distance * distance);
+        if(bound <= lightTreeErrorBound){
+            PointLight light = fetchPointLight(int(boxMax.w));
+            light.ambient = ambient.rgb;
+            light.diffuse = diffuse.rgb;
+            light.specular = specular.rgb;
+            result += CalcPointLight(light, normal, fragPos, viewDir, TexColor);
+        }else{
+            stack[top++] = int(boxMin.w);
+            stack[top++] = int(boxMin.w) + 1;
+        }
+    }
+    return result;
+}
+#endif
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec4 TexColor){
 
     vec3 lightDir = normalize(-light.direction);
@@ -82,15 +173,37 @@ void main()
     vec3 viewDir = normalize(viewPosition - FragPos);
 
     vec4 TexColor = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
         if(TexColor.a < 0.1)
             discard;
+#endif
 
     vec3 result = vec3(0.0);
     result += CalcDirLight(dirLight, normal, viewDir, TexColor);
 
-    for(int i=0; i < nPointLights && i < MAX_N_POINT_LIGHTS; i++){
-        result += CalcPointLight(pointLight[i], normal, FragPos, viewDir, TexColor);
+#if defined(LIGHTS_CLUSTERED)
+    uvec2 range = texelFetch(clusterRanges, findCluster(FragPos)).xy;
+    for(uint j = 0u; j < range.y; j++){
+        int i = int(texelFetch(clusterLightIndices, int(range.x + j)).r);
+        result += CalcPointLight(fetchPointLight(i), normal, FragPos, viewDir, TexColor);
+    }
+#elif defined(LIGHTS_TREE)
+    if(nPointLights > 0)
+        result += CalcLightTree(normal, FragPos, viewDir, TexColor);
+#else
+#if defined(LIGHTS_PER_MESH)
+    if(nMeshLights >= 0){
+        for(int j = 0; j < nMeshLights; j++){
+            result += CalcPointLight(fetchPointLight(meshLights[j]), normal, FragPos, viewDir, TexColor);
+        }
+    }else
+#endif
+    {
+        for(int i=0; i < nPointLights; i++){
+            result += CalcPointLight(fetchPointLight(i), normal, FragPos, viewDir, TexColor);
+        }
     }
+#endif
 
     float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
      if(brightness > 1.0){
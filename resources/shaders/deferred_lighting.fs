@@ -0,0 +1,216 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+};
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform float shininess;
+
+uniform DirLight dirLight;
+uniform samplerBuffer pointLightPositions;  // xyz: position, unused with ANALYTIC_FIREFLIES
+uniform samplerBuffer pointLightProperties; // 3 texels per light: ambient + constant, diffuse + linear, specular + quadratic
+uniform int nPointLights;                   // live lights, the buffers hold up to the pool capacity
+
+PointLight fetchPointLight(int i)
+{
+    PointLight light;
+#ifdef ANALYTIC_FIREFLIES
+    light.position = fireflyMotion(uint(i));
+#else
+    light.position = texelFetch(pointLightPositions, i).xyz;
+#endif
+    vec4 ambient = texelFetch(pointLightProperties, 3 * i);
+    vec4 diffuse = texelFetch(pointLightProperties, 3 * i + 1);
+    vec4 specular = texelFetch(pointLightProperties, 3 * i + 2);
+    light.ambient = ambient.rgb;
+    light.diffuse = diffuse.rgb;
+    light.specular = specular.rgb;
+    light.constant = ambient.a;
+    light.linear = diffuse.a;
+    light.quadratic = specular.a;
+    return light;
+}
+
+uniform vec3 viewPosition;
+
+// variant keywords and constants, defined by the renderer (see ShaderVariants):
+//  LIGHT_VOLUMES - point lights are added by light_volume.fs, only the directional light is shaded here
+//  LIGHTS_CLUSTERED - only the lights of the fragment's cluster are shaded
+//  LIGHTS_TREE - the light tree is cut per fragment, see 2.model_lighting.fs
+//  LIGHTS_SAMPLED - only the light picked for the pixel by restir.fs is shaded
+//  ANALYTIC_FIREFLIES - light positions from fireflyMotion (firefly_motion.glsl) instead of the light buffer
+//  CLUSTER_TILES_X/Y, CLUSTER_SLICES, LIGHT_TREE_DEPTH
+
+#if defined(LIGHTS_CLUSTERED) && !defined(LIGHT_VOLUMES)
+uniform usamplerBuffer clusterRanges;       // per cluster: first index, light count
+uniform usamplerBuffer clusterLightIndices;
+uniform vec2 clusterTileSize;
+uniform float clusterNear;
+uniform float clusterSliceScale;            // CLUSTER_SLICES / log(far / near)
+
+int findCluster(float depth)
+{
+    int slice = clamp(int(floor(log(depth / clusterNear) * clusterSliceScale)), 0, CLUSTER_SLICES - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    return tile.x + CLUSTER_TILES_X * (tile.y + CLUSTER_TILES_Y * slice);
+}
+#elif defined(LIGHTS_SAMPLED) && !defined(LIGHT_VOLUMES)
+uniform sampler2D lightReservoirs;          // light, contribution weight, sample count
+#elif defined(LIGHTS_TREE) && !defined(LIGHT_VOLUMES)
+uniform samplerBuffer lightTreeNodes;       // 5 texels per node, see LightTree
+uniform float lightTreeErrorBound;          // largest contribution a node may have and still be shaded as one light
+#endif
+
+// same lighting model as 2.model_lighting.fs, with material values read from the G-buffer
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularStrength)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularStrength;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+#if defined(LIGHTS_TREE) && !defined(LIGHT_VOLUMES)
+// same traversal as in 2.model_lighting.fs
+vec3 CalcLightTree(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularStrength)
+{
+    vec3 result = vec3(0.0);
+    int stack[LIGHT_TREE_DEPTH + 1];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        int node = stack[--top];
+        vec4 boxMin = texelFetch(lightTreeNodes, 5 * node);
+        vec4 boxMax = texelFetch(lightTreeNodes, 5 * node + 1);
+        if(boxMin.w < 0.0){
+            // leaf, a single light
+            result += CalcPointLight(fetchPointLight(int(-boxMin.w) - 1), normal, fragPos, viewDir, albedo, specularStrength);
+            continue;
+        }
+        vec4 ambient = texelFetch(lightTreeNodes, 5 * node + 2);
+        vec4 diffuse = texelFetch(lightTreeNodes, 5 * node + 3);
+        vec4 specular = texelFetch(lightTreeNodes, 5 * node + 4);
+        // no light of the subtree is closer than the box, or attenuates less than the smallest terms
+        float distance = length(max(max(boxMin.xyz - fragPos, fragPos - boxMax.xyz), 0.0));
+        vec3 intensity = ambient.rgb + diffuse.rgb + specular.rgb;
+        float bound = max(intensity.r, max(intensity.g, intensity.b)) / (ambient.a + diffuse.a * distance + specular.a * distance * distance);
+        if(bound <= lightTreeErrorBound){
+            PointLight light = fetchPointLight(int(boxMax.w));
+            light.ambient = ambient.rgb;
+            light.diffuse = diffuse.rgb;
+            light.specular = specular.rgb;
+            result += CalcPointLight(light, normal, fragPos, viewDir, albedo, specularStrength);
+        }else{
+            stack[top++] = int(boxMin.w);
+            stack[top++] = int(boxMin.w) + 1;
+        }
+    }
+    return result;
+}
+#endif
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float specularStrength){
+
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(viewDir, lightDir), 0.0);
+
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularStrength;
+
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+    float depth = texture(gDepth, TexCoords).r;
+    // nothing was rasterized here, the skybox is drawn later
+    if(depth == 1.0)
+        discard;
+
+    // reconstructing the world position from depth
+    vec4 viewPos = inverseProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    viewPos /= viewPos.w;
+    vec3 FragPos = vec3(inverseView * viewPos);
+
+    vec3 albedo = texture(gAlbedo, TexCoords).rgb;
+    vec3 normal = texture(gNormal, TexCoords).xyz;
+    float specularStrength = texture(gSpecular, TexCoords).r;
+    vec3 viewDir = normalize(viewPosition - FragPos);
+
+    vec3 result = vec3(0.0);
+    result += CalcDirLight(dirLight, normal, viewDir, albedo, specularStrength);
+
+#if defined(LIGHT_VOLUMES)
+    // point lights are accumulated by the light volume pass
+#elif defined(LIGHTS_CLUSTERED)
+    uvec2 range = texelFetch(clusterRanges, findCluster(-viewPos.z)).xy;
+    for(uint j = 0u; j < range.y; j++){
+        int i = int(texelFetch(clusterLightIndices, int(range.x + j)).r);
+        result += CalcPointLight(fetchPointLight(i), normal, FragPos, viewDir, albedo, specularStrength);
+    }
+#elif defined(LIGHTS_SAMPLED)
+    // estimate of the sum over all lights: the picked light weighted by its contribution weight
+    vec4 reservoir = texelFetch(lightReservoirs, ivec2(gl_FragCoord.xy), 0);
+    if(reservoir.x >= 0.0)
+        result += CalcPointLight(fetchPointLight(int(reservoir.x)), normal, FragPos, viewDir, albedo, specularStrength) * reservoir.y;
+#elif defined(LIGHTS_TREE)
+    if(nPointLights > 0)
+        result += CalcLightTree(normal, FragPos, viewDir, albedo, specularStrength);
+#else
+    for(int i=0; i < nPointLights; i++){
+        result += CalcPointLight(fetchPointLight(i), normal, FragPos, viewDir, albedo, specularStrength);
+    }
+#endif
+
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+     if(brightness > 1.0){
+         BrightColor = vec4(result, 1.0);
+     }else{
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+    }
+    FragColor = vec4(result, 1.0);
+}
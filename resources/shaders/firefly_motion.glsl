@@ -0,0 +1,59 @@
+// Analytic firefly motion, pasted after the #version line of the shaders that place lights (see
+// ShaderVariants::include). A firefly's position is a function of its index, the seed and the time:
+// it glides between random control points around a random home, one control point every
+// FIREFLY_SEGMENT_MS, eased in and out. Everything is integer math on a fixed point grid of 1/65536
+// world units and the result converts to float exactly, so rg/FireflyMotion.h computes the very same
+// bits on the CPU. Constants have to match the ones there.
+
+uniform int fireflySeed;
+uniform int fireflyTime;    // milliseconds, wraps around
+
+const uint FIREFLY_SEGMENT_SHIFT = 12u;     // 4096 ms between control points
+const uint FIREFLY_STEP_SHIFT = 2u;         // positions change every 4 ms, 1024 steps per segment
+const uint FIREFLY_HOME_RANGE = 6553600u;   // homes within [-50, 50) on x and z
+const int FIREFLY_HOME_OFFSET = 3276800;
+const int FIREFLY_FIXED_HALF = 131072;      // homes within [-2, 2) on y, control points within 2 of home
+
+// the counter-based generator of rg/Random.h, the stream is the firefly's index
+uint fireflyRandomMix(uint x)
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+uint fireflyRandomBits(uint key, uint counter)
+{
+    return fireflyRandomMix(key + counter * 0x9e3779b9u);
+}
+
+// a control point in fixed point, the top 18 bits of each axis are an offset within 2 of home
+ivec3 fireflyControlPoint(uint key, ivec3 home, uint segment)
+{
+    uint counter = 4u + 3u * segment;
+    return home + ivec3(int(fireflyRandomBits(key, counter) >> 14u),
+                        int(fireflyRandomBits(key, counter + 1u) >> 14u),
+                        int(fireflyRandomBits(key, counter + 2u) >> 14u)) - FIREFLY_FIXED_HALF;
+}
+
+vec3 fireflyMotion(uint id)
+{
+    uint key = fireflyRandomMix(uint(fireflySeed) ^ fireflyRandomMix(id + 0x9e3779b9u));
+    ivec3 home = ivec3(int((fireflyRandomBits(key, 0u) >> 8u) % FIREFLY_HOME_RANGE) - FIREFLY_HOME_OFFSET,
+                       int(fireflyRandomBits(key, 1u) >> 14u) - FIREFLY_FIXED_HALF,
+                       int((fireflyRandomBits(key, 2u) >> 8u) % FIREFLY_HOME_RANGE) - FIREFLY_HOME_OFFSET);
+    // every firefly is at its own point of its segment
+    uint time = uint(fireflyTime) + (fireflyRandomBits(key, 3u) >> (32u - FIREFLY_SEGMENT_SHIFT));
+    uint segment = time >> FIREFLY_SEGMENT_SHIFT;
+    ivec3 from = fireflyControlPoint(key, home, segment);
+    ivec3 to = fireflyControlPoint(key, home, segment + 1u);
+
+    // smoothstep in 12 bits: f^2 (3 - 2f) with f in 10 bits is below 2^32
+    uint f = (time >> FIREFLY_STEP_SHIFT) & 1023u;
+    int s = int((f * f * (3072u - 2u * f)) >> 18u);
+    ivec3 position = from + ((to - from) * s >> 12);
+    return vec3(position) * (1.0 / 65536.0);
+}
@@ -0,0 +1,59 @@
+#version 330 core
+layout (location = 0) in vec4 aPosition;
+layout (location = 1) in vec3 aVelocity;
+
+// captured by transform feedback into the other set of firefly buffers (see GpuFireflySystem)
+out vec4 outPosition;
+out vec3 outVelocity;
+
+uniform bool retarget;      // draw new velocities before moving
+uniform int tick;           // number of the retarget, counted from 1
+uniform int seed;
+uniform float maxSpeed;
+uniform float yLimit;
+
+// the counter-based generator of rg/Random.h, the stream is the firefly's index
+uint randomMix(uint x)
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+uint randomKey(uint seed, uint stream)
+{
+    return randomMix(seed ^ randomMix(stream + 0x9e3779b9u));
+}
+
+uint randomBits(uint key, uint counter)
+{
+    return randomMix(key + counter * 0x9e3779b9u);
+}
+
+// velocity in [-maxSpeed, maxSpeed) from the top 24 bits, same as FireflySystem
+float randomVelocity(uint key, uint axis)
+{
+    uint bits = randomBits(key, 3u * uint(tick) + axis);
+    return (float(int(bits >> 8u)) * (2.0 / 16777216.0) - 1.0) * maxSpeed;
+}
+
+void main()
+{
+    vec3 velocity = aVelocity;
+    if(retarget){
+        uint key = randomKey(uint(seed), uint(gl_VertexID));
+        velocity.x = randomVelocity(key, 0u);
+        // the vertical velocity is dropped where it would take the firefly out of (-yLimit, yLimit)
+        float y = randomVelocity(key, 1u);
+        velocity.y = (aPosition.y + y > -yLimit && aPosition.y + y < yLimit) ? y : 0.0;
+        velocity.z = randomVelocity(key, 2u);
+    }
+
+    vec3 position = aPosition.xyz + velocity;
+    position.y = clamp(position.y, -yLimit, yLimit);
+    outPosition = vec4(position, 1.0);
+    outVelocity = velocity;
+}
@@ -0,0 +1,29 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gNormal;
+layout (location = 2) out vec4 gSpecular;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+
+    float shininess;
+};
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform Material material;
+
+void main()
+{
+    vec4 TexColor = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
+        if(TexColor.a < 0.1)
+            discard;
+#endif
+
+    gAlbedo = vec4(TexColor.rgb, 1.0);
+    gNormal = vec4(normalize(Normal), 1.0);
+    gSpecular = vec4(texture(material.texture_specular1, TexCoords).rrr, 1.0);
+}
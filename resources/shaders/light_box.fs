@@ -2,17 +2,12 @@
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
 
-in VS_OUT {
-    vec3 FragPos;
-    vec3 Normal;
-    vec2 TexCoords;
-} fs_in;
-
-uniform vec3 lightColor;
+// light_box.vs, the color comes with the light's instance
+flat in vec3 LightColor;
 
 void main()
 {           
-    FragColor = vec4(lightColor, 1.0);
+    FragColor = vec4(LightColor, 1.0);
     float brightness = dot(FragColor.rgb, vec3(0.2126, 0.7152, 0.0722));
     if(brightness > 1.0)
         BrightColor = vec4(FragColor.rgb, 1.0);
@@ -0,0 +1,26 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// one instance per point light, drawn where the light buffers say it is, or with ANALYTIC_FIREFLIES where
+// fireflyMotion (firefly_motion.glsl) puts it
+flat out vec3 LightColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform float scale;
+
+uniform samplerBuffer pointLightPositions;  // xyz: position
+uniform samplerBuffer pointLightProperties; // 3 texels per light: ambient + constant, diffuse + linear, specular + quadratic
+
+void main()
+{
+#ifdef ANALYTIC_FIREFLIES
+    vec3 position = fireflyMotion(uint(gl_InstanceID));
+#else
+    vec3 position = texelFetch(pointLightPositions, gl_InstanceID).xyz;
+#endif
+    LightColor = texelFetch(pointLightProperties, 3 * gl_InstanceID).rgb
+               + texelFetch(pointLightProperties, 3 * gl_InstanceID + 1).rgb
+               + texelFetch(pointLightProperties, 3 * gl_InstanceID + 2).rgb;
+    gl_Position = projection * view * vec4(position + aPos * scale, 1.0);
+}
@@ -0,0 +1,92 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+flat in int LightIndex;
+flat in float LightRadius;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+uniform vec2 screenSize;
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform float shininess;
+
+uniform samplerBuffer pointLightPositions;  // xyz: position
+uniform samplerBuffer pointLightProperties; // 3 texels per light: ambient + constant, diffuse + linear, specular + quadratic
+
+PointLight fetchPointLight(int i)
+{
+    PointLight light;
+    light.position = texelFetch(pointLightPositions, i).xyz;
+    vec4 ambient = texelFetch(pointLightProperties, 3 * i);
+    vec4 diffuse = texelFetch(pointLightProperties, 3 * i + 1);
+    vec4 specular = texelFetch(pointLightProperties, 3 * i + 2);
+    light.ambient = ambient.rgb;
+    light.diffuse = diffuse.rgb;
+    light.specular = specular.rgb;
+    light.constant = ambient.a;
+    light.linear = diffuse.a;
+    light.quadratic = specular.a;
+    return light;
+}
+
+uniform vec3 viewPosition;
+
+// same lighting model as 2.model_lighting.fs, with material values read from the G-buffer
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularStrength)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularStrength;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+    vec2 TexCoords = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, TexCoords).r;
+
+    vec4 viewPos = inverseProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    viewPos /= viewPos.w;
+    vec3 FragPos = vec3(inverseView * viewPos);
+
+    // the depth test only rejects geometry behind the volume, this rejects what is in front of it
+    PointLight light = fetchPointLight(LightIndex);
+    if(length(light.position - FragPos) > LightRadius)
+        discard;
+
+    vec3 albedo = texture(gAlbedo, TexCoords).rgb;
+    vec3 normal = texture(gNormal, TexCoords).xyz;
+    float specularStrength = texture(gSpecular, TexCoords).r;
+    vec3 viewDir = normalize(viewPosition - FragPos);
+
+    FragColor = vec4(CalcPointLight(light, normal, FragPos, viewDir, albedo, specularStrength), 1.0);
+}
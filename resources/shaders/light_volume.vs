@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aLightSphere; // center, radius
+layout (location = 2) in uint aLightIndex;
+
+flat out int LightIndex;
+flat out float LightRadius;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+void main()
+{
+    LightIndex = int(aLightIndex);
+    LightRadius = aLightSphere.w;
+    gl_Position = projection * view * vec4(aLightSphere.xyz + aPos * aLightSphere.w, 1.0);
+}
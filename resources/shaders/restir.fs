@@ -0,0 +1,205 @@
+#version 330 core
+layout (location = 0) out vec4 Reservoir;   // light (-1 if none), contribution weight, sample count
+layout (location = 1) out vec4 Surface;     // normal, view depth of the pixel the reservoir was made for
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+in vec2 TexCoords;
+
+// variant keywords and constants, defined by the renderer (see ShaderVariants):
+//  SPATIAL_REUSE - second pass, merges the reservoirs of nearby pixels. Without it new candidates are
+//                  drawn and merged with the reprojected reservoir of the last frame.
+//  ANALYTIC_FIREFLIES - light positions from fireflyMotion (firefly_motion.glsl) instead of the light buffer
+
+// candidate lights drawn per pixel and frame
+#define CANDIDATES 8
+// neighbours merged by the spatial pass and how far away (in pixels) they are picked
+#define SPATIAL_SAMPLES 4
+#define SPATIAL_RADIUS 24.0
+// the history may count at most this many times the samples of the current frame
+#define HISTORY_LIMIT 20.0
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+uniform sampler2D reservoirs;   // last frame's final reservoirs, or this frame's temporal ones for SPATIAL_REUSE
+uniform sampler2D surfaces;     // and the surfaces they belong to
+
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform mat4 previousViewProjection;
+uniform vec3 viewPosition;
+uniform float shininess;
+uniform int frameIndex;
+
+uniform samplerBuffer pointLightPositions;  // xyz: position, unused with ANALYTIC_FIREFLIES
+uniform samplerBuffer pointLightProperties; // 3 texels per light: ambient + constant, diffuse + linear, specular + quadratic
+uniform int nPointLights;                   // live lights, the buffers hold up to the pool capacity
+
+PointLight fetchPointLight(int i)
+{
+    PointLight light;
+#ifdef ANALYTIC_FIREFLIES
+    light.position = fireflyMotion(uint(i));
+#else
+    light.position = texelFetch(pointLightPositions, i).xyz;
+#endif
+    vec4 ambient = texelFetch(pointLightProperties, 3 * i);
+    vec4 diffuse = texelFetch(pointLightProperties, 3 * i + 1);
+    vec4 specular = texelFetch(pointLightProperties, 3 * i + 2);
+    light.ambient = ambient.rgb;
+    light.diffuse = diffuse.rgb;
+    light.specular = specular.rgb;
+    light.constant = ambient.a;
+    light.linear = diffuse.a;
+    light.quadratic = specular.a;
+    return light;
+}
+
+// same lighting model as deferred_lighting.fs
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularStrength)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularStrength;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+// pcg hash, one state per pixel and pass
+uint rngState;
+
+float random()
+{
+    rngState = rngState * 747796405u + 2891336453u;
+    uint word = ((rngState >> ((rngState >> 28u) + 4u)) ^ rngState) * 277803737u;
+    return float(((word >> 22u) ^ word) >> 8u) / 16777216.0;
+}
+
+vec3 FragPos;
+vec3 normal;
+vec3 viewDir;
+vec3 albedo;
+float specularStrength;
+
+// target function of the resampling: luminance of the light's (unshadowed) contribution to this pixel
+float targetPdf(int light)
+{
+    vec3 color = CalcPointLight(fetchPointLight(light), normal, FragPos, viewDir, albedo, specularStrength);
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// weighted reservoir sampling, only the weight sum is needed while merging
+int selected = -1;
+float weightSum = 0.0;
+float sampleCount = 0.0;
+
+void addSample(int light, float weight, float count)
+{
+    weightSum += weight;
+    sampleCount += count;
+    if(weight > 0.0 && random() * weightSum < weight)
+        selected = light;
+}
+
+// merges a reservoir made for another pixel (or frame), its light is reweighted for this pixel
+void addReservoir(vec4 reservoir, float maxCount)
+{
+    int light = int(reservoir.x);
+    float count = min(reservoir.z, maxCount);
+    // the light may have been despawned since
+    if(light < 0 || light >= nPointLights || count <= 0.0)
+        return;
+    addSample(light, targetPdf(light) * reservoir.y * count, count);
+}
+
+// reservoirs are only shared between pixels that see about the same surface
+bool similarSurface(vec4 other, float depth)
+{
+    return other.w > 0.0 && dot(other.xyz, normal) > 0.9 && abs(other.w - depth) < 0.1 * depth;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // nothing was rasterized here
+    if(depth == 1.0){
+        Reservoir = vec4(-1.0, 0.0, 0.0, 0.0);
+        Surface = vec4(0.0);
+        return;
+    }
+
+    // reconstructing the world position from depth
+    vec4 viewPos = inverseProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    viewPos /= viewPos.w;
+    FragPos = vec3(inverseView * viewPos);
+    normal = texelFetch(gNormal, pixel, 0).xyz;
+    viewDir = normalize(viewPosition - FragPos);
+    albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+    specularStrength = texelFetch(gSpecular, pixel, 0).r;
+    float viewDepth = -viewPos.z;
+    ivec2 size = textureSize(gDepth, 0);
+
+#ifndef SPATIAL_REUSE
+    rngState = uint(pixel.x + size.x * pixel.y) * 1973u + uint(frameIndex) * 9277u;
+
+    // candidates are drawn uniformly (pdf 1 / nPointLights) and resampled by their contribution
+    for(int i = 0; i < CANDIDATES && nPointLights > 0; i++){
+        int light = min(int(random() * float(nPointLights)), nPointLights - 1);
+        addSample(light, targetPdf(light) * float(nPointLights), 1.0);
+    }
+
+    // temporal reuse: the reservoir of the same surface point in the last frame
+    vec4 previous = previousViewProjection * vec4(FragPos, 1.0);
+    ivec2 previousPixel = ivec2(floor((previous.xy / previous.w * 0.5 + 0.5) * vec2(size)));
+    if(previous.w > 0.0 && all(greaterThanEqual(previousPixel, ivec2(0))) && all(lessThan(previousPixel, size))){
+        if(similarSurface(texelFetch(surfaces, previousPixel, 0), previous.w))
+            addReservoir(texelFetch(reservoirs, previousPixel, 0), HISTORY_LIMIT * CANDIDATES);
+    }
+#else
+    rngState = uint(pixel.x + size.x * pixel.y) * 1973u + uint(frameIndex) * 9277u + 26699u;
+
+    addReservoir(texelFetch(reservoirs, pixel, 0), 1e30);
+    for(int i = 0; i < SPATIAL_SAMPLES; i++){
+        float angle = 6.2831853 * random();
+        vec2 offset = SPATIAL_RADIUS * sqrt(random()) * vec2(cos(angle), sin(angle));
+        ivec2 neighbour = clamp(pixel + ivec2(offset), ivec2(0), size - 1);
+        if(similarSurface(texelFetch(surfaces, neighbour, 0), viewDepth))
+            addReservoir(texelFetch(reservoirs, neighbour, 0), 1e30);
+    }
+#endif
+
+    // contribution weight of the selected light: W = weightSum / (M * target(selected))
+    float contributionWeight = 0.0;
+    if(selected >= 0){
+        float target = targetPdf(selected);
+        if(target > 0.0)
+            contributionWeight = weightSum / (sampleCount * target);
+    }
+    Reservoir = vec4(float(selected), contributionWeight, sampleCount, 0.0);
+    Surface = vec4(normal, viewDepth);
+}
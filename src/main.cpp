@@ -13,14 +13,45 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
+#include <rg/PointLightBuffer.h>
+#include <rg/LightClusters.h>
+#include <rg/LightReservoirs.h>
+#include <rg/LightTree.h>
+#include <rg/LightVolumes.h>
+#include <rg/MeshLightCulling.h>
+#include <rg/ModelCollider.h>
+#include <rg/SceneConfig.h>
+#include <rg/FireflyFlock.h>
+#include <rg/FireflyLod.h>
+#include <rg/FireflyMotion.h>
+#include <rg/FireflySimulation.h>
+#include <rg/FireflySystem.h>
+#include <rg/GLStateCache.h>
+#include <rg/GpuFireflySystem.h>
+#include <rg/JobSystem.h>
+#include <rg/Random.h>
+#include <rg/RenderQueue.h>
+#include <rg/ShaderVariants.h>
+#include <rg/SimulationClock.h>
+#include <rg/StreamingBuffer.h>
+#include <rg/TripleBuffer.h>
+#include <rg/TriangleBVH.h>
 
 #include <iostream>
 #include <cstdlib>
 
 #include "vertices.h"
 
-#define N_FIREFLIES (196)
 #define Y_LIMIT (5)
+// light reservoirs of the sampled lighting passes, next to the G-buffer's units 0-3
+#define LIGHT_RESERVOIRS_UNIT (4)
+#define LIGHT_SURFACES_UNIT (5)
+// texture units of the clustered shading lookups, above the ones used by the model's materials
+#define CLUSTER_RANGES_UNIT (8)
+#define CLUSTER_INDICES_UNIT (9)
+#define POINT_LIGHT_POSITIONS_UNIT (10)
+#define POINT_LIGHT_PROPERTIES_UNIT (11)
+#define LIGHT_TREE_UNIT (12)
 
 float Gamma = 1.0f;
 float exposure = 1.0f;
@@ -42,12 +73,24 @@ unsigned int loadRGBATexture(const std::string& path);
 
 void renderQuad();
 
-void generateFireflies(glm::vec3 coords[], int n);
+void generateFireflies(glm::vec3 coords[], unsigned int first, unsigned int n, uint32_t seed);
+
+void setLightingUniforms(const Shader &shader, const LightClusterGrid &lightClusters, const LightTree &lightTree);
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
 const unsigned int SCR_HEIGHT = 750;
 const int MAX_RAND = 200;
+// the fireflies move at a fixed rate, whatever the frame rate
+const double SIMULATION_RATE = 60.0;
+// largest distance a firefly moves per simulation tick along each axis
+const float FIREFLY_SPEED = 0.01f;
+// ticks between changes of direction (3 seconds)
+const uint64_t FIREFLY_RETARGET_TICKS = 180;
+// fireflies per job of the parallel firefly update, a multiple of the SIMD width
+const unsigned int FIREFLY_CHUNK = 4096;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 
 // camera
 
@@ -55,28 +98,22 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
-int timer=0;
-float xs[N_FIREFLIES];
-float ys[N_FIREFLIES];
-float yp = 0;
-float zs[N_FIREFLIES];
+// live fireflies, the pool can grow up to its capacity while running
+unsigned int nFireflies;
+unsigned int fireflyCapacity;
+// the CPU simulation thread, for the position edits of the ImGui window
+FireflySimulation *fireflySimulation;
+// the forest's triangles where it is drawn, for camera collision and picking
+ModelCollider forestCollider;
+// analytic firefly motion (firefly_motion.glsl): the scene's seed and the frame's time in milliseconds
+uint32_t fireflySeed;
+uint32_t fireflyTime = 0;
 
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-PointLight pointLights[N_FIREFLIES];
+std::vector<PointLight> pointLights;
 
 struct DirLight {
     glm::vec3 direction;
@@ -86,22 +123,89 @@ struct DirLight {
     glm::vec3 ambient;
 };
 
+// how point lights are picked for each fragment, selects the LIGHTS_* variant of the lighting shaders
+enum LightAssignment {
+    ALL_LIGHTS,
+    PER_MESH_LIGHTS,    // forward only, deferred shading falls back to all lights
+    CLUSTERED_LIGHTS,
+    LIGHT_TREE,         // lightcuts, distant groups of lights are shaded as one
+    SAMPLED_LIGHTS      // deferred only, forward shading falls back to clustered lights
+};
+
+// RenderQueue passes of the scene, in drawing order. The forest passes go to the G-buffer with deferred
+// shading, the rest is drawn after the lighting passes.
+enum DrawPass {
+    OPAQUE_PASS,
+    ALPHA_TESTED_PASS,
+    LIGHT_CUBE_PASS,
+    SKY_PASS            // no depth writes, behind everything else
+};
+
+// RenderQueue shaders, the forest's is the variant for the pass and the light assignment
+enum DrawShader {
+    FOREST_SHADER,
+    LIGHT_CUBE_SHADER,
+    SKYBOX_SHADER,
+    CAT_SKYBOX_SHADER   // drawn over the skybox
+};
+
 struct ProgramState {
     glm::vec3 clearColor = glm::vec3(0);
     bool ImGuiEnabled = true;
     Camera camera;
     bool CameraMouseMovementUpdateEnabled = true;
+    bool cameraCollision = false;   // the camera can't move into the forest
+    float cameraRadius = 0.2f;
     glm::vec3 forestPosition = glm::vec3(0.0f, -5.0f, 10.0f);
     float forestScale = 1.0f;
     DirLight dirLight;
-
+    bool deferredShading = false;
+    bool lightVolumes = false;
+    bool gpuFireflies = false;      // fireflies moved by transform feedback, positions never leave the GPU
+    bool analyticFireflies = false; // positions computed in the shaders from the time, the simulation pauses
+    bool flocking = true;           // CPU simulation only
+    FireflyFlock::Settings flock;
+    bool fireflyCollision = true;   // CPU simulation only
+    bool simulationLod = true;      // CPU random walk only, distant fireflies are advanced less often
+    unsigned int lodCounts[FireflyLod::Tiers] = {};
+    bool pointLightsEdited = false;
+    int fireflyCount = 0;           // pool size asked for in the ImGui window
+    int despawnFirefly = -1;
+    int lightAssignment = CLUSTERED_LIGHTS;
+    float lightCutoff = 0.05f;
+    float lightTreeErrorBound = 0.02f;
+    unsigned int clusterAssignments = 0;
+    unsigned int maxLightsPerCluster = 0;
+    unsigned int lightVolumeCount = 0;
+    bool streamingPersistent = false;
+    unsigned int streamingStalls = 0;
+    GLStateCache::Counters stateCalls;
+    unsigned int meshLightAssignments = 0;
+    unsigned int lightTreeNodes = 0;
 };
 
 ProgramState *programState;
 
 void DrawImGui(ProgramState *pSta);
 
-int main() {
+void renderScene(GLFWwindow *window, const SceneConfig &sceneConfig, JobSystem &jobs);
+
+int main(int argc, char **argv) {
+
+    // scene settings: config file first, then command line overrides
+    SceneConfig sceneConfig;
+    loadSceneConfig("resources/scene.cfg", sceneConfig);
+    parseCommandLine(argc, argv, sceneConfig);
+    nFireflies = sceneConfig.fireflies;
+    fireflyCapacity = std::max(sceneConfig.maxFireflies, nFireflies);
+    JobSystem jobs(sceneConfig.threads >= 0 ? sceneConfig.threads : JobSystem::defaultWorkerCount());
+    if (sceneConfig.benchmark) {
+        benchmarkFireflySystem(std::cout, jobs, FIREFLY_CHUNK);
+        benchmarkFireflyFlock(std::cout, jobs, FIREFLY_CHUNK);
+        benchmarkModelCollider(std::cout, jobs, FIREFLY_CHUNK);
+        benchmarkFireflyLod(std::cout, jobs, FIREFLY_CHUNK);
+        return stressTripleBuffer(std::cout) ? 0 : 1;
+    }
 
     // glfw: initialize and configure
     glfwInit();
@@ -134,9 +238,16 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // the streaming buffer is persistently mapped where the driver can do it
+    if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+        StreamingBuffer::loadBufferStorage((GLADloadproc) glfwGetProcAddress);
 
 
     programState = new ProgramState;
+    programState->gpuFireflies = sceneConfig.gpuFireflies;
+    programState->analyticFireflies = sceneConfig.analyticFireflies;
+    programState->flocking = sceneConfig.flocking;
+    programState->fireflyCount = nFireflies;
     if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
@@ -150,34 +261,91 @@ int main() {
     ImGui_ImplOpenGL3_Init("#version 330 core");
 
 
+    // draws until the window is closed, the GL objects of the scene are gone when it returns
+    renderScene(window, sceneConfig, jobs);
+
+    // termination
+    delete programState;
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+    // glfw: terminate, clearing all previously allocated GLFW resources.
+    glfwTerminate();
+
+    return 0;
+}
+
+// everything that is drawn and the render loop, until the window is closed. Its locals hold GL objects,
+// so they have to go while the context is still there.
+void renderScene(GLFWwindow *window, const SceneConfig &sceneConfig, JobSystem &jobs) {
     // configure global opengl state
-    glEnable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState().enable(GL_BLEND);
+    glState().enable(GL_DEPTH_TEST);
+    glState().depthFunc(GL_LESS);
+    glState().enable(GL_CULL_FACE);
+    glState().blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // firefly movement initialization
-    for(int i=0; i<N_FIREFLIES; i++){
-        xs[i] = 0;
-        ys[i] = 0;
-        zs[i] = 0;
-    }
+    FireflySystem fireflies(nFireflies, sceneConfig.seed);
+    pointLights.resize(nFireflies);
 
     // build and compile shaders
-    Shader ourShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs");
+    // -------------------------
+    // permutations of the lighting shaders are compiled on first use
+    ShaderVariants forwardShaders("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs");
+    // variant of the lighting shaders for every LightAssignment
+    unsigned int forwardLightVariants[] = {
+        0,
+        forwardShaders.keyword("LIGHTS_PER_MESH"),
+        forwardShaders.keyword("LIGHTS_CLUSTERED"),
+        forwardShaders.keyword("LIGHTS_TREE"),
+        0
+    };
+    unsigned int forwardAlphaTest = forwardShaders.keyword("ALPHA_TEST");
+    unsigned int forwardAnalytic = forwardShaders.keyword("ANALYTIC_FIREFLIES");
+    ShaderVariants gBufferShaders("resources/shaders/2.model_lighting.vs", "resources/shaders/gbuffer.fs");
+    unsigned int gBufferAlphaTest = gBufferShaders.keyword("ALPHA_TEST");
+    ShaderVariants deferredShaders("resources/shaders/bloom_final.vs", "resources/shaders/deferred_lighting.fs");
+    unsigned int deferredLightVariants[] = {
+        0,
+        0,
+        deferredShaders.keyword("LIGHTS_CLUSTERED"),
+        deferredShaders.keyword("LIGHTS_TREE"),
+        deferredShaders.keyword("LIGHTS_SAMPLED")
+    };
+    ShaderVariants restirShaders("resources/shaders/bloom_final.vs", "resources/shaders/restir.fs");
+    unsigned int restirSpatial = restirShaders.keyword("SPATIAL_REUSE");
+    unsigned int restirAnalytic = restirShaders.keyword("ANALYTIC_FIREFLIES");
+    unsigned int deferredLightVolumes = deferredShaders.keyword("LIGHT_VOLUMES");
+    unsigned int deferredAnalytic = deferredShaders.keyword("ANALYTIC_FIREFLIES");
+    ShaderVariants bloomFinalShaders("resources/shaders/bloom_final.vs", "resources/shaders/bloom_final.fs");
+    unsigned int bloomFinalBloom = bloomFinalShaders.keyword("BLOOM");
+    for (ShaderVariants* variants: {&forwardShaders, &deferredShaders}) {
+        variants->define("MAX_MESH_LIGHTS", MeshLightCuller::MaxLightsPerMesh);
+        variants->define("CLUSTER_TILES_X", LightClusterGrid::TilesX);
+        variants->define("CLUSTER_TILES_Y", LightClusterGrid::TilesY);
+        variants->define("CLUSTER_SLICES", LightClusterGrid::Slices);
+        variants->define("LIGHT_TREE_DEPTH", LightTree::depth(fireflyCapacity));
+    }
+    for (ShaderVariants* variants: {&forwardShaders, &deferredShaders, &restirShaders})
+        variants->include("resources/shaders/firefly_motion.glsl");
     Shader skyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
     Shader catSkyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
-    Shader lightShader("resources/shaders/2.model_lighting.vs", "resources/shaders/light_box.fs");
     Shader blurShader("resources/shaders/blur.vs", "resources/shaders/blur.fs");
-    Shader bloomFinalShader("resources/shaders/bloom_final.vs", "resources/shaders/bloom_final.fs");
+    Shader lightVolumeShader("resources/shaders/light_volume.vs", "resources/shaders/light_volume.fs");
+    Shader brightExtractShader("resources/shaders/bloom_final.vs", "resources/shaders/bright_extract.fs");
+    Shader fireflyUpdateShader("resources/shaders/firefly_update.vs", GpuFireflySystem::feedbackVaryings());
+    Shader instancedLightShader("resources/shaders/light_box.vs", "resources/shaders/light_box.fs");
+    Shader analyticLightShader("resources/shaders/light_box.vs", "resources/shaders/light_box.fs",
+                               "#define ANALYTIC_FIREFLIES\n"
+                               + loadShaderSnippet("resources/shaders/firefly_motion.glsl"));
 
 
     // skybox vertex initialization
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    glState().bindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *) nullptr);
@@ -202,7 +370,7 @@ int main() {
     unsigned int catTrumpetVAO, catTrumpetVBO;
     glGenVertexArrays(1, &catTrumpetVAO);
     glGenBuffers(1, &catTrumpetVBO);
-    glBindVertexArray(catTrumpetVAO);
+    glState().bindVertexArray(catTrumpetVAO);
     glBindBuffer(GL_ARRAY_BUFFER, catTrumpetVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(catTrumpetVertices), &catTrumpetVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *) nullptr);
@@ -230,31 +398,35 @@ int main() {
         cubeTexture = loadRGBATexture(texture);
     }
 
-    glm::vec3 cubePositions[N_FIREFLIES];
-    generateFireflies(cubePositions, N_FIREFLIES);
+    std::vector<glm::vec3> fireflyPositions(nFireflies);
+    generateFireflies(fireflyPositions.data(), 0, nFireflies, sceneConfig.seed);
+    for(unsigned int i=0; i<nFireflies; i++)
+        fireflies.setPosition(i, fireflyPositions[i]);
 
     // load models
     Model forestModel("resources/objects/forest/forest.obj");
     forestModel.SetShaderTextureNamePrefix("material.");
-
-    // pointLight
-    pointLights[0].position = cubePositions[0];
-    pointLights[0].ambient = glm::vec3(1.0f);
-    pointLights[0].diffuse = glm::vec3(1.6f);
-    pointLights[0].specular = glm::vec3(1.0f);
-    pointLights[0].constant = 0.0f;
-    pointLights[0].linear = 0.6f;
-    pointLights[0].quadratic = 0.9f;
-
-    // setting pointLight positions to be the same as fireflies' and copying other attributes from the initial pointLight
-    for(int i=1; i<N_FIREFLIES; i++){
-        pointLights[i].position = cubePositions[i];
-        pointLights[i].ambient = pointLights[0].ambient;
-        pointLights[i].diffuse = pointLights[0].diffuse;
-        pointLights[i].specular = pointLights[0].specular;
-        pointLights[i].constant = pointLights[0].constant;
-        pointLights[i].linear = pointLights[0].linear;
-        pointLights[i].quadratic = pointLights[0].quadratic;
+    // collision geometry of the forest in model space, placed where it is drawn every frame
+    TriangleBVH forestBVH;
+    for (const Mesh& mesh: forestModel.meshes)
+        forestBVH.addMesh(mesh.vertices, mesh.indices);
+    forestBVH.build();
+    forestCollider = ModelCollider(&forestBVH, programState->forestPosition, programState->forestScale);
+
+    // pointLight, every firefly spawns with these attributes
+    PointLight fireflyLight;
+    fireflyLight.position = glm::vec3(0.0f);
+    fireflyLight.ambient = glm::vec3(1.0f);
+    fireflyLight.diffuse = glm::vec3(1.6f);
+    fireflyLight.specular = glm::vec3(1.0f);
+    fireflyLight.constant = 0.0f;
+    fireflyLight.linear = 0.6f;
+    fireflyLight.quadratic = 0.9f;
+
+    // setting pointLight positions to be the same as fireflies'
+    for(unsigned int i=0; i<nFireflies; i++){
+        pointLights[i] = fireflyLight;
+        pointLights[i].position = fireflyPositions[i];
     }
 
     // dirLight
@@ -264,22 +436,100 @@ int main() {
     dirLight.diffuse = glm::vec3(1.0f);
     dirLight.specular = glm::vec3(0.2f);
 
-    ourShader.use();
-    ourShader.setFloat("material.shininess", 128.0f);
-    ourShader.setInt("nPointLights", N_FIREFLIES);
+    forwardShaders.onCompile = [](Shader& shader) {
+        shader.setFloat("material.shininess", 128.0f);
+        shader.setInt("pointLightPositions", POINT_LIGHT_POSITIONS_UNIT);
+        shader.setInt("pointLightProperties", POINT_LIGHT_PROPERTIES_UNIT);
+    };
+
+    PointLightBuffer pointLightBuffer(fireflyCapacity);
+    // the fireflies move on the simulation thread, or on the GPU driven from the render loop
+    FireflySimulation simulation(fireflies, jobs, {SIMULATION_RATE, FIREFLY_SPEED, Y_LIMIT, FIREFLY_RETARGET_TICKS,
+                                                   FIREFLY_CHUNK, sceneConfig.flocking});
+    fireflySimulation = &simulation;
+    ModelCollider fireflyCollider = forestCollider;
+    simulation.setCollider(fireflyCollider);
+    simulation.start(0);
+    GpuFireflySystem gpuFireflySystem(fireflyCapacity);
+    bool gpuFirefliesActive = false;
+    bool analyticFirefliesActive = false;
+    SimulationClock simulationClock(SIMULATION_RATE);
+    LightClusterGrid lightClusters;
+    LightTree lightTree;
+    LightReservoirs lightReservoirs(SCR_WIDTH, SCR_HEIGHT);
+    bool reservoirHistory = false;
+    int frameIndex = 0;
+    glm::mat4 previousViewProjection(1.0f);
+    LightVolumes lightVolumes;
+    RenderQueue renderQueue;
+    // per-frame vertex data, room for three frames of light volumes in flight
+    StreamingBuffer streamingBuffer(GL_ARRAY_BUFFER, 3 * LightVolumes::streamSize(fireflyCapacity) + (1 << 16));
+    programState->streamingPersistent = streamingBuffer.persistent();
+    MeshLightCuller meshLightCuller;
+    std::vector<int> meshLightIndices;
 
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 
     catSkyboxShader.use();
-    skyboxShader.setInt("skybox", 0);
+    catSkyboxShader.setInt("skybox", 0);
 
     blurShader.use();
     blurShader.setInt("image", 0);
 
-    bloomFinalShader.use();
-    bloomFinalShader.setInt("scene", 0);
-    bloomFinalShader.setInt("bloomBlur", 1);
+    bloomFinalShaders.onCompile = [](Shader& shader) {
+        shader.setInt("scene", 0);
+        shader.setInt("bloomBlur", 1);
+    };
+
+    deferredShaders.onCompile = [](Shader& shader) {
+        shader.setInt("gAlbedo", 0);
+        shader.setInt("gNormal", 1);
+        shader.setInt("gSpecular", 2);
+        shader.setInt("gDepth", 3);
+        shader.setFloat("shininess", 128.0f);
+        shader.setInt("pointLightPositions", POINT_LIGHT_POSITIONS_UNIT);
+        shader.setInt("pointLightProperties", POINT_LIGHT_PROPERTIES_UNIT);
+        shader.setInt("lightReservoirs", LIGHT_RESERVOIRS_UNIT);
+    };
+
+    restirShaders.onCompile = [](Shader& shader) {
+        shader.setInt("gAlbedo", 0);
+        shader.setInt("gNormal", 1);
+        shader.setInt("gSpecular", 2);
+        shader.setInt("gDepth", 3);
+        shader.setInt("reservoirs", LIGHT_RESERVOIRS_UNIT);
+        shader.setInt("surfaces", LIGHT_SURFACES_UNIT);
+        shader.setFloat("shininess", 128.0f);
+        shader.setInt("pointLightPositions", POINT_LIGHT_POSITIONS_UNIT);
+        shader.setInt("pointLightProperties", POINT_LIGHT_PROPERTIES_UNIT);
+    };
+
+    lightVolumeShader.use();
+    lightVolumeShader.setInt("gAlbedo", 0);
+    lightVolumeShader.setInt("gNormal", 1);
+    lightVolumeShader.setInt("gSpecular", 2);
+    lightVolumeShader.setInt("gDepth", 3);
+    lightVolumeShader.setFloat("shininess", 128.0f);
+    lightVolumeShader.setVec2("screenSize", SCR_WIDTH, SCR_HEIGHT);
+    lightVolumeShader.setInt("pointLightPositions", POINT_LIGHT_POSITIONS_UNIT);
+    lightVolumeShader.setInt("pointLightProperties", POINT_LIGHT_PROPERTIES_UNIT);
+
+    brightExtractShader.use();
+    brightExtractShader.setInt("scene", 0);
+
+    fireflyUpdateShader.use();
+    fireflyUpdateShader.setFloat("maxSpeed", FIREFLY_SPEED);
+    fireflyUpdateShader.setFloat("yLimit", Y_LIMIT);
+    fireflyUpdateShader.setInt("seed", (int) sceneConfig.seed);
+
+    fireflySeed = sceneConfig.seed;
+    for (Shader* shader: {&instancedLightShader, &analyticLightShader}) {
+        shader->use();
+        shader->setFloat("scale", 0.05f);
+        shader->setInt("pointLightPositions", POINT_LIGHT_POSITIONS_UNIT);
+        shader->setInt("pointLightProperties", POINT_LIGHT_PROPERTIES_UNIT);
+    }
 
     // configure (floating point) framebuffers
     // ---------------------------------------
@@ -291,7 +541,7 @@ int main() {
     glGenTextures(2, colorBuffers);
     for (unsigned int i = 0; i < 2; i++)
     {
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
+        glState().bindTexture(0, GL_TEXTURE_2D, colorBuffers[i]);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -300,12 +550,12 @@ int main() {
         // attach texture to framebuffer
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
     }
-    // create and attach depth buffer (renderbuffer)
+    // create and attach depth buffer (renderbuffer), same format as the G-buffer depth so it can be blitted
     unsigned int rboDepth;
     glGenRenderbuffers(1, &rboDepth);
     glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
     // tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
     unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
     glDrawBuffers(2, attachments);
@@ -314,6 +564,44 @@ int main() {
         std::cout << "Framebuffer not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // framebuffer writing only the brightness threshold target, for when the scene color is accumulated first
+    unsigned int brightFBO;
+    glGenFramebuffers(1, &brightFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, brightFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffers[1], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Framebuffer not complete!" << std::endl;
+
+    // G-buffer for deferred shading, its depth is a texture so the lighting passes can read it
+    unsigned int gBuffer;
+    glGenFramebuffers(1, &gBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+    unsigned int gBufferTextures[3];
+    GLenum gBufferFormats[3] = { GL_RGBA8, GL_RGBA16F, GL_R8 }; // albedo, normal, specular
+    glGenTextures(3, gBufferTextures);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        glState().bindTexture(0, GL_TEXTURE_2D, gBufferTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, gBufferFormats[i], SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, gBufferTextures[i], 0);
+    }
+    unsigned int depthStencilTexture;
+    glGenTextures(1, &depthStencilTexture);
+    glState().bindTexture(0, GL_TEXTURE_2D, depthStencilTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture, 0);
+    unsigned int gBufferAttachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(3, gBufferAttachments);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "G-buffer not complete!" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
     // ping-pong-framebuffer for blurring
     unsigned int pingpongFBO[2];
     unsigned int pingpongColorbuffers[2];
@@ -322,7 +610,7 @@ int main() {
     for (unsigned int i = 0; i < 2; i++)
     {
         glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[i]);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
+        glState().bindTexture(0, GL_TEXTURE_2D, pingpongColorbuffers[i]);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -343,126 +631,409 @@ int main() {
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // the forest may have been moved in the ImGui window, the simulation gets the change at its next tick
+        forestCollider.position = programState->forestPosition;
+        forestCollider.scale = programState->forestScale;
+        ModelCollider collider = forestCollider;
+        if (!programState->fireflyCollision)
+            collider.bvh = nullptr;
+        if (collider.bvh != fireflyCollider.bvh || collider.position != fireflyCollider.position ||
+            collider.scale != fireflyCollider.scale) {
+            fireflyCollider = collider;
+            simulation.setCollider(fireflyCollider);
+        }
+
         // input
         processInput(window);
-
-        // Bind the custom framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-
-        // render
-        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glEnable(GL_DEPTH_TEST);
+        // the simulation levels of detail follow the camera
+        simulation.setLod(programState->simulationLod, programState->camera.Position);
 
         // don't forget to enable shader before setting uniforms
         // view/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
         glm::mat4 view = programState->camera.GetViewMatrix();
         glm::mat4 model = glm::mat4(1.0f);
+        int lightAssignment = programState->lightAssignment;
+        if (lightAssignment == SAMPLED_LIGHTS && !programState->deferredShading)
+            lightAssignment = CLUSTERED_LIGHTS;
+        // with the simulation on the GPU the CPU doesn't know where the lights are, only the assignments
+        // that read positions in the shaders are left
+        bool gpuFireflies = programState->gpuFireflies;
+        // analytic motion places the lights in the shaders, the CPU evaluates it only for the assignments that
+        // cull lights on the CPU. Light volumes read the light buffer.
+        bool analyticFireflies = programState->analyticFireflies;
+        if (gpuFireflies && !analyticFireflies && lightAssignment != SAMPLED_LIGHTS)
+            lightAssignment = ALL_LIGHTS;
+        bool useLightVolumes = programState->lightVolumes && !gpuFireflies && !analyticFireflies;
+
+        // analytic motion needs no simulation, the running one pauses and later continues where it stopped
+        if (analyticFireflies != analyticFirefliesActive) {
+            if (gpuFirefliesActive) {
+                if (!analyticFireflies) {
+                    uint64_t tick = simulationClock.tick;
+                    simulationClock = SimulationClock(SIMULATION_RATE);
+                    simulationClock.tick = tick;
+                }
+            } else if (analyticFireflies) {
+                simulation.stop();
+            } else {
+                simulation.start(simulation.stop());
+            }
+            analyticFirefliesActive = analyticFireflies;
+        }
 
-        ourShader.use();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
+        // switching simulations, the new one continues where the other one stopped. Not while they are paused.
+        if (gpuFireflies != gpuFirefliesActive && !analyticFireflies) {
+            if (gpuFireflies) {
+                uint64_t tick = simulation.stop();
+                gpuFireflySystem.upload(simulation.state());
+                simulationClock = SimulationClock(SIMULATION_RATE);
+                simulationClock.tick = tick;
+            } else {
+                gpuFireflySystem.download(simulation.state());
+                simulation.start(simulationClock.tick);
+            }
+            gpuFirefliesActive = gpuFireflies;
+        }
 
-        // loading dirLight into shader
-        {
-            ourShader.setVec3("dirLight.direction", dirLight.direction);
-            ourShader.setVec3("dirLight.ambient", dirLight.ambient);
-            ourShader.setVec3("dirLight.diffuse", dirLight.diffuse);
-            ourShader.setVec3("dirLight.specular", dirLight.specular);
+        // growing, shrinking or despawning from the pool: the simulation pauses for the edit, so the state it
+        // publishes next and the lights change together. Despawned slots are filled with the last firefly.
+        if (programState->despawnFirefly >= 0 || programState->fireflyCount != (int) nFireflies) {
+            uint64_t tick = gpuFirefliesActive ? simulationClock.tick : simulation.stop();
+            FireflySystem& state = simulation.state();
+            if (gpuFirefliesActive)
+                gpuFireflySystem.download(state);
+
+            unsigned int despawn = programState->despawnFirefly;
+            if (despawn < state.size()) {
+                state.despawn(despawn);
+                pointLights[despawn] = pointLights.back();
+                pointLights.pop_back();
+                if (programState->fireflyCount == (int) nFireflies)
+                    programState->fireflyCount--;
+            }
+            unsigned int count = std::min((unsigned int) std::max(programState->fireflyCount, 0), fireflyCapacity);
+            unsigned int first = state.size();
+            if (count > first) {
+                std::vector<glm::vec3> spawned(count - first);
+                generateFireflies(spawned.data(), first, count - first, sceneConfig.seed);
+                for (unsigned int i = first; i < count; i++)
+                    state.spawn(spawned[i - first]);
+            } else {
+                state.resize(count);
+            }
+            pointLights.resize(count, fireflyLight);
+            for (unsigned int i = first; i < count; i++)
+                pointLights[i].position = state.position(i);
+
+            nFireflies = count;
+            programState->fireflyCount = count;
+            programState->despawnFirefly = -1;
+            programState->pointLightsEdited = true;
+            if (gpuFirefliesActive)
+                gpuFireflySystem.upload(state);
+            else if (!analyticFireflies)
+                simulation.start(tick);
         }
 
-        // loading pointLights into shader
+        // moving fireflies and loading pointLights into the light buffer
         {
-            for(int i=0; i<N_FIREFLIES; i++) {
-
-                if(timer + 2 < (int)currentFrame) {
-                xs[i] = ((rand() % MAX_RAND) - 100) * 1.0f / 10000.0f;
-                yp = ((rand() % MAX_RAND) - 100) * 1.0f / 10000.0f;
-                ys[i] = yp*(yp + pointLights[i].position.y > -5.0f && yp + pointLights[i].position.y < 5.0f);
-                zs[i] = ((rand() % MAX_RAND) - 100) * 1.0f / 10000.0f;
+            if(analyticFireflies) {
+                // nothing to upload, the positions only exist on the CPU for culling. The simulations are paused,
+                // the job system is free.
+                fireflyTime = (uint32_t) (uint64_t) (glfwGetTime() * 1000.0);
+                bool cpuCulling = lightAssignment == CLUSTERED_LIGHTS || lightAssignment == LIGHT_TREE
+                                  || (lightAssignment == PER_MESH_LIGHTS && !programState->deferredShading);
+                if(cpuCulling) {
+                    jobs.parallelFor(0, nFireflies, FIREFLY_CHUNK, [](unsigned int begin, unsigned int end) {
+                        for(unsigned int i=begin; i<end; i++)
+                            pointLights[i].position = fireflyMotion(fireflySeed, i, fireflyTime);
+                    });
+                }
+            } else if(gpuFireflies) {
+                // the simulation ticks that passed since the last frame, every FIREFLY_RETARGET_TICKS the fireflies
+                // change direction (change number n is the firefly random streams' tick n)
+                unsigned int ticks = simulationClock.advance(SimulationClock::now());
+                uint64_t firstTick = simulationClock.tick - ticks + 1;
+                // one transform feedback pass per tick moves all fireflies, rendered at the last tick
+                fireflyUpdateShader.use();
+                for(uint64_t tick = firstTick; tick <= simulationClock.tick; tick++) {
+                    fireflyUpdateShader.setBool("retarget", tick % FIREFLY_RETARGET_TICKS == 0);
+                    fireflyUpdateShader.setInt("tick", (int) (tick / FIREFLY_RETARGET_TICKS));
+                    gpuFireflySystem.step();
                 }
+            } else {
+                // the newest state the simulation thread finished, the lights are placed between its last two ticks
+                const FireflySnapshot& snapshot = simulation.latest();
+                float alpha = snapshot.alpha(SimulationClock::now(), 1.0 / SIMULATION_RATE);
+                for(unsigned int i=0; i<nFireflies; i++)
+                    pointLights[i].position = snapshot.fireflies.position(i, alpha, Y_LIMIT);
+                std::copy(snapshot.tierCounts, snapshot.tierCounts + FireflyLod::Tiers, programState->lodCounts);
+            }
 
-                pointLights[i].position += glm::vec3(xs[i], ys[i], zs[i]);
-                pointLights[i].position.y = min(5.0f, pointLights[i].position.y);
-                pointLights[i].position.y = max(-5.0f, pointLights[i].position.y);
-
-                ourShader.setVec3("pointLight[" + to_string(i) + "].position", pointLights[i].position);
-                ourShader.setVec3("pointLight[" + to_string(i) + "].ambient", pointLights[i].ambient);
-                ourShader.setVec3("pointLight[" + to_string(i) + "].diffuse", pointLights[i].diffuse);
-                ourShader.setVec3("pointLight[" + to_string(i) + "].specular", pointLights[i].specular);
-                ourShader.setFloat("pointLight[" + to_string(i) + "].constant", pointLights[i].constant);
-                ourShader.setFloat("pointLight[" + to_string(i) + "].linear", pointLights[i].linear);
-                ourShader.setFloat("pointLight[" + to_string(i) + "].quadratic", pointLights[i].quadratic);
-                cubePositions[i] = {
-                         pointLights[i].position.x,
-                         pointLights[i].position.y,
-                         pointLights[i].position.z
-                };
+            // the light buffer tracks dirty ranges, so it is filled on this thread. The GPU simulation leaves
+            // the positions alone, there only edits of the light colors have to be uploaded.
+            if((!gpuFireflies && !analyticFireflies) || programState->pointLightsEdited) {
+                for(unsigned int i=0; i<nFireflies; i++)
+                    pointLightBuffer.set(i, pointLights[i]);
+                programState->pointLightsEdited = false;
+            }
+            pointLightBuffer.upload();
+            pointLightBuffer.bind(POINT_LIGHT_POSITIONS_UNIT, POINT_LIGHT_PROPERTIES_UNIT);
+            if(gpuFireflies)
+                gpuFireflySystem.bindPositions(POINT_LIGHT_POSITIONS_UNIT);
+
+            // assigning lights to view frustum clusters so fragments only loop over nearby lights
+            if(lightAssignment == CLUSTERED_LIGHTS) {
+                lightClusters.cutoff = programState->lightCutoff;
+                lightClusters.build(view, glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT,
+                                    NEAR_PLANE, FAR_PLANE, pointLights.data(), nFireflies);
+                programState->clusterAssignments = lightClusters.assignedLights;
+                programState->maxLightsPerCluster = lightClusters.maxLightsPerCluster;
             }
-            if(timer + 2 < (int)currentFrame) {
-                timer += 3;
+            // light hierarchy the shaders cut per fragment
+            if(lightAssignment == LIGHT_TREE && !(programState->deferredShading && useLightVolumes)) {
+                lightTree.build(pointLights.data(), nFireflies);
+                programState->lightTreeNodes = lightTree.nodeCount;
+            }
+            // influence spheres for the per-mesh light lists
+            if(!programState->deferredShading && lightAssignment == PER_MESH_LIGHTS) {
+                meshLightCuller.cutoff = programState->lightCutoff;
+                meshLightCuller.setLights(pointLights.data(), nFireflies, FAR_PLANE);
+            }
+            // bounding spheres of the lights for the deferred light volume pass
+            if(programState->deferredShading && useLightVolumes) {
+                lightVolumes.cutoff = programState->lightCutoff;
+                lightVolumes.update(pointLights.data(), nFireflies, FAR_PLANE, streamingBuffer);
+                programState->lightVolumeCount = lightVolumes.count();
             }
-            ourShader.use();
-            ourShader.setVec3("viewPosition", programState->camera.Position);
         }
 
         // render the loaded model
         model = glm::mat4(1.0f);
         model = glm::translate(model,programState->forestPosition); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(programState->forestScale));    // it's a bit too big for our scene, so scale it down
-        ourShader.setMat4("model", model);
-
-        glDisable(GL_CULL_FACE);
-        forestModel.Draw(ourShader);
-        glEnable(GL_CULL_FACE);
-
-
-        // drawing skybox
-        glCullFace(GL_BACK);
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);
-
-        skyboxShader.use();
-        skyboxShader.setMat4("projection", projection);
-        skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-
-        //drawing cat skybox
-        catSkyboxShader.use();
-        catSkyboxShader.setMat4("projection", projection);
-        catSkyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
-        glBindVertexArray(catTrumpetVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, catTrumpetTexture);
-        glDrawArrays(GL_TRIANGLES, 30, 6);
-
-
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS);
-
-        // finally show all the light sources as bright cubes
-        lightShader.use();
-        lightShader.setMat4("projection", projection);
-        lightShader.setMat4("view", view);
-
-        for(unsigned int i = 0; i < N_FIREFLIES; i++) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePositions[i]);
-            //float angle = 20.0f * i;
-            //model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-            model = glm::scale(model, glm::vec3(0.05f));
-            lightShader.setMat4("model", model);
-            lightShader.setVec3("lightColor", (pointLights[i].ambient + pointLights[i].diffuse + pointLights[i].specular));
-            glBindTexture(GL_TEXTURE_2D, cubeTexture);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+
+        // the frame's draws sorted by pass, shader, textures and then front to back
+        renderQueue.clear();
+        for (unsigned int i = 0; i < forestModel.meshes.size(); i++) {
+            const Mesh& mesh = forestModel.meshes[i];
+            glm::vec4 center = view * model * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f);
+            renderQueue.push(RenderQueue::key(mesh.alphaTest ? ALPHA_TESTED_PASS : OPAQUE_PASS, FOREST_SHADER,
+                                              mesh.material, -center.z), i);
+        }
+        renderQueue.push(RenderQueue::key(LIGHT_CUBE_PASS, LIGHT_CUBE_SHADER, 0, 0.0f), 0);
+        renderQueue.push(RenderQueue::key(SKY_PASS, SKYBOX_SHADER, 0, 0.0f), 0);
+        renderQueue.push(RenderQueue::key(SKY_PASS, CAT_SKYBOX_SHADER, 0, 0.0f), 0);
+        renderQueue.sort();
+
+        // render
+        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
+        glState().enable(GL_DEPTH_TEST);
+
+        bool sampledLights = programState->deferredShading && !useLightVolumes && lightAssignment == SAMPLED_LIGHTS;
+        if (programState->deferredShading) {
+            // 1. geometry pass: render the forest's material attributes into the G-buffer
+            glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glState().disable(GL_BLEND);
+
+            glState().disable(GL_CULL_FACE);
+            // opaque meshes first, so alpha tested ones behind them are rejected by the depth test
+            Shader* gBufferShader = nullptr;
+            unsigned int currentPass = ~0u;
+            renderQueue.submit(OPAQUE_PASS, ALPHA_TESTED_PASS, [&](const RenderQueue::Packet& packet) {
+                unsigned int pass = RenderQueue::pass(packet.key);
+                if (pass != currentPass) {
+                    currentPass = pass;
+                    gBufferShader = &gBufferShaders.use(pass == ALPHA_TESTED_PASS ? gBufferAlphaTest : 0);
+                    gBufferShader->setMat4("projection", projection);
+                    gBufferShader->setMat4("view", view);
+                    gBufferShader->setMat4("model", model);
+                }
+                forestModel.meshes[packet.item].Draw(*gBufferShader);
+            });
+            glState().enable(GL_CULL_FACE);
+
+            // the lighting passes read the G-buffer depth, hdrFBO gets a copy to keep testing against the scene
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, hdrFBO);
+            glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+            glState().disable(GL_DEPTH_TEST);
+            for (unsigned int i = 0; i < 3; i++) {
+                glState().bindTexture(i, GL_TEXTURE_2D, gBufferTextures[i]);
+            }
+            glState().bindTexture(3, GL_TEXTURE_2D, depthStencilTexture);
+
+            if (sampledLights) {
+                // picking one light per pixel: fresh candidates merged with the pixel's reservoir of the last frame,
+                // then with the reservoirs of its neighbours
+                if (!reservoirHistory)
+                    lightReservoirs.reset();
+                for (LightReservoirs::Pass pass: {LightReservoirs::Temporal, LightReservoirs::Spatial}) {
+                    Shader& restirShader = restirShaders.use((pass == LightReservoirs::Spatial ? restirSpatial : 0)
+                                                             | (analyticFireflies ? restirAnalytic : 0));
+                    restirShader.setMat4("inverseProjection", glm::inverse(projection));
+                    restirShader.setMat4("inverseView", glm::inverse(view));
+                    restirShader.setMat4("previousViewProjection", previousViewProjection);
+                    restirShader.setVec3("viewPosition", programState->camera.Position);
+                    restirShader.setInt("frameIndex", frameIndex);
+                    restirShader.setInt("nPointLights", nFireflies);
+                    restirShader.setInt("fireflySeed", (int) fireflySeed);
+                    restirShader.setInt("fireflyTime", (int) fireflyTime);
+                    lightReservoirs.bindTextures(pass == LightReservoirs::Temporal ? LightReservoirs::Spatial : LightReservoirs::Temporal,
+                                                 LIGHT_RESERVOIRS_UNIT, LIGHT_SURFACES_UNIT);
+                    lightReservoirs.bindTarget(pass);
+                    renderQuad();
+                }
+                lightReservoirs.bindTextures(LightReservoirs::Spatial, LIGHT_RESERVOIRS_UNIT, LIGHT_SURFACES_UNIT);
+                previousViewProjection = projection * view;
+                frameIndex++;
+            }
+
+            // 2. lighting pass: shade every visible texel once, into the same HDR targets as forward rendering
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            unsigned int deferredVariant = useLightVolumes ? deferredLightVolumes
+                    : deferredLightVariants[lightAssignment] | (analyticFireflies ? deferredAnalytic : 0);
+            Shader& deferredShader = deferredShaders.use(deferredVariant);
+            deferredShader.setMat4("inverseProjection", glm::inverse(projection));
+            deferredShader.setMat4("inverseView", glm::inverse(view));
+            setLightingUniforms(deferredShader, lightClusters, lightTree);
+            renderQuad();
+
+            if (useLightVolumes) {
+                // 3. light volumes: the back faces of a light's sphere only pass the depth test where the scene
+                // lies in front of them, each covered pixel adds that one light to the scene color
+                glDrawBuffers(1, attachments);
+                glState().enable(GL_DEPTH_TEST);
+                glState().depthMask(false);
+                glState().depthFunc(GL_GEQUAL);
+                glState().cullFace(GL_FRONT);
+                glState().enable(GL_BLEND);
+                glState().blendFunc(GL_ONE, GL_ONE);
+
+                lightVolumeShader.use();
+                lightVolumeShader.setMat4("projection", projection);
+                lightVolumeShader.setMat4("view", view);
+                lightVolumeShader.setMat4("inverseProjection", glm::inverse(projection));
+                lightVolumeShader.setMat4("inverseView", glm::inverse(view));
+                lightVolumeShader.setVec3("viewPosition", programState->camera.Position);
+                lightVolumes.draw();
+
+                glState().blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glState().disable(GL_BLEND);
+                glState().cullFace(GL_BACK);
+                glState().depthFunc(GL_LESS);
+                glState().depthMask(true);
+                glState().disable(GL_DEPTH_TEST);
+                glDrawBuffers(2, attachments);
+
+                // brightness threshold of the accumulated color for bloom
+                glBindFramebuffer(GL_FRAMEBUFFER, brightFBO);
+                brightExtractShader.use();
+                glState().bindTexture(0, GL_TEXTURE_2D, colorBuffers[0]);
+                renderQuad();
+                glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            }
+
+            glState().enable(GL_DEPTH_TEST);
+            glState().enable(GL_BLEND);
+        } else {
+            // Bind the custom framebuffer
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            bool perMeshLights = lightAssignment == PER_MESH_LIGHTS;
+            unsigned int forwardVariant = forwardLightVariants[lightAssignment] | (analyticFireflies ? forwardAnalytic : 0);
+            programState->meshLightAssignments = 0;
+
+            glState().disable(GL_CULL_FACE);
+            // opaque meshes first, so alpha tested ones behind them are rejected by the depth test
+            Shader* ourShader = nullptr;
+            unsigned int currentPass = ~0u;
+            int nMeshLightsUniform = -1, meshLightsUniform = -1;
+            renderQueue.submit(OPAQUE_PASS, ALPHA_TESTED_PASS, [&](const RenderQueue::Packet& packet) {
+                unsigned int pass = RenderQueue::pass(packet.key);
+                if (pass != currentPass) {
+                    currentPass = pass;
+                    ourShader = &forwardShaders.use(forwardVariant | (pass == ALPHA_TESTED_PASS ? forwardAlphaTest : 0));
+                    ourShader->setMat4("projection", projection);
+                    ourShader->setMat4("view", view);
+                    ourShader->setMat4("model", model);
+                    setLightingUniforms(*ourShader, lightClusters, lightTree);
+                    nMeshLightsUniform = ourShader->getUniform("nMeshLights");
+                    meshLightsUniform = ourShader->getUniform("meshLights[0]");
+                }
+                Mesh& mesh = forestModel.meshes[packet.item];
+                // every mesh only gets the lights that overlap its bounding box
+                if (perMeshLights) {
+                    if (meshLightCuller.cull(mesh.boundsMin, mesh.boundsMax, model, meshLightIndices)) {
+                        ourShader->setInt(nMeshLightsUniform, meshLightIndices.size());
+                        ourShader->setIntArray(meshLightsUniform, meshLightIndices.data(), meshLightIndices.size());
+                        programState->meshLightAssignments += meshLightIndices.size();
+                    } else {
+                        ourShader->setInt(nMeshLightsUniform, -1);
+                        programState->meshLightAssignments += nFireflies;
+                    }
+                }
+                mesh.Draw(*ourShader);
+            });
+            glState().enable(GL_CULL_FACE);
         }
+        // the reservoirs only make a useful history while they are updated every frame
+        reservoirHistory = sampledLights;
+
+
+        // the light cubes, then the skyboxes behind everything
+        glState().cullFace(GL_BACK);
+        renderQueue.submit(LIGHT_CUBE_PASS, SKY_PASS, [&](const RenderQueue::Packet& packet) {
+            switch (RenderQueue::shader(packet.key)) {
+                case LIGHT_CUBE_SHADER: {
+                    // one instance per light: placed by the motion function, or where the light buffer says
+                    // (positions uploaded from the CPU simulation above or left there by the GPU one). One draw
+                    // call however many fireflies there are.
+                    Shader& shader = analyticFireflies ? analyticLightShader : instancedLightShader;
+                    shader.use();
+                    shader.setMat4("projection", projection);
+                    shader.setMat4("view", view);
+                    if (analyticFireflies) {
+                        shader.setInt("fireflySeed", (int) fireflySeed);
+                        shader.setInt("fireflyTime", (int) fireflyTime);
+                    }
+                    // the cat overlay's cube, scaled down to a light's size by light_box.vs
+                    glState().bindVertexArray(catTrumpetVAO);
+                    glState().bindTexture(0, GL_TEXTURE_2D, cubeTexture);
+                    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, nFireflies);
+                    break;
+                }
+                case SKYBOX_SHADER:
+                    glState().depthMask(false);
+                    glState().depthFunc(GL_LEQUAL);
+                    skyboxShader.use();
+                    skyboxShader.setMat4("projection", projection);
+                    skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
+                    glState().bindVertexArray(skyboxVAO);
+                    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture);
+                    glDrawArrays(GL_TRIANGLES, 0, 36);
+                    break;
+                case CAT_SKYBOX_SHADER:
+                    glState().depthMask(false);
+                    glState().depthFunc(GL_LEQUAL);
+                    catSkyboxShader.use();
+                    catSkyboxShader.setMat4("projection", projection);
+                    catSkyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
+                    glState().bindVertexArray(catTrumpetVAO);
+                    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, catTrumpetTexture);
+                    glDrawArrays(GL_TRIANGLES, 30, 6);
+                    break;
+            }
+        });
+        glState().depthMask(true);
+        glState().depthFunc(GL_LESS);
 
         // Bind the default framebuffer
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -477,7 +1048,7 @@ int main() {
         {
             glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
             blurShader.setInt("horizontal", horizontal);
-            glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
+            glState().bindTexture(0, GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
 
             renderQuad();
 
@@ -492,41 +1063,36 @@ int main() {
 // 3. now render floating point color buffer to 2D quad and tonemap HDR colors to default framebuffer's (clamped) color range
         // --------------------------------------------------------------------------------------------------------------------------
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        bloomFinalShader.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[0]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
-        bloomFinalShader.setInt("bloom", bloom);
+        Shader& bloomFinalShader = bloomFinalShaders.use(bloom ? bloomFinalBloom : 0);
+        glState().bindTexture(0, GL_TEXTURE_2D, colorBuffers[0]);
+        glState().bindTexture(1, GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
         bloomFinalShader.setFloat("exposure", exposure);
         bloomFinalShader.setFloat("gamma", Gamma);
 
         renderQuad();
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
+        glState().enable(GL_DEPTH_TEST);
+        glState().enable(GL_CULL_FACE);
+
+        // state changes of the frame, ImGui's are not counted
+        programState->stateCalls = glState().counters();
+        glState().resetCounters();
 
         if (programState->ImGuiEnabled)
             DrawImGui(programState);
 
+        // everything streamed this frame is drawn
+        streamingBuffer.endFrame();
+        programState->streamingStalls = streamingBuffer.stalls();
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    // termination
-    delete programState;
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
     glDeleteVertexArrays(1, &skyboxVAO);
     glDeleteBuffers(1, &skyboxVBO);
     glDeleteVertexArrays(1, &catTrumpetVAO);
     glDeleteBuffers(1, &catTrumpetVBO);
-    // glfw: terminate, clearing all previously allocated GLFW resources.
-    glfwTerminate();
-
-    return 0;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -535,6 +1101,7 @@ void processInput(GLFWwindow *window) {
         glfwSetWindowShouldClose(window, true);
 
     deltaTime *= 2;
+    glm::vec3 cameraPosition = programState->camera.Position;
 
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         programState->camera.ProcessKeyboard(FORWARD, deltaTime);
@@ -556,6 +1123,13 @@ void processInput(GLFWwindow *window) {
         programState->camera.ProcessKeyboard(UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
         programState->camera.ProcessKeyboard(DOWN, deltaTime);
+
+    // moves into the forest are undone, a camera that already is inside can leave
+    float radius = programState->cameraRadius;
+    if (programState->cameraCollision && programState->camera.Position != cameraPosition &&
+        forestCollider.overlapsSphere(programState->camera.Position, radius) &&
+        !forestCollider.overlapsSphere(cameraPosition, radius))
+        programState->camera.Position = cameraPosition;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -611,6 +1185,13 @@ void DrawImGui(ProgramState *pState) {
         ImGui::Text("(Yaw, Pitch): (%f, %f)", c.Yaw, c.Pitch);
         ImGui::Text("Camera front: (%f, %f, %f)", c.Front.x, c.Front.y, c.Front.z);
         ImGui::Checkbox("Camera mouse update", &pState->CameraMouseMovementUpdateEnabled);
+        ImGui::Checkbox("Camera collision", &pState->cameraCollision);
+        // picking: the forest triangle in the middle of the screen
+        TriangleBVH::Hit hit;
+        if (forestCollider.raycast(c.Position, c.Front, FAR_PLANE, hit))
+            ImGui::Text("Looking at: forest triangle %u, %.2f away", hit.triangle, hit.t);
+        else
+            ImGui::Text("Looking at: nothing");
         ImGui::End();
     }
     {
@@ -621,17 +1202,73 @@ void DrawImGui(ProgramState *pState) {
         ImGui::DragFloat3("Specular", (float*)&pState->dirLight.specular, 0.05, 0 ,5);
         ImGui::End();
     }
+    {
+        ImGui::Begin("Lighting info");
+        ImGui::Text("Frame time: %.3f ms", 1000.0f / ImGui::GetIO().Framerate);
+        ImGui::Checkbox("Deferred shading", &pState->deferredShading);
+        ImGui::Checkbox("Light volumes (deferred)", &pState->lightVolumes);
+        ImGui::Checkbox("GPU firefly simulation", &pState->gpuFireflies);
+        ImGui::Checkbox("Analytic firefly motion", &pState->analyticFireflies);
+        if (pState->analyticFireflies)
+            ImGui::Text("Analytic motion: paths computed in the shaders, the simulation is paused, no light volumes");
+        if (pState->gpuFireflies)
+            ImGui::Text("GPU simulation: all or sampled lights, no light volumes, no flocking, no collision");
+        bool flockEdited = ImGui::Checkbox("Flocking", &pState->flocking);
+        if (pState->flocking) {
+            flockEdited |= ImGui::DragFloat("Flock radius", &pState->flock.radius, 0.05, 0.1, 5.0);
+            flockEdited |= ImGui::DragFloat("Separation", &pState->flock.separation, 0.0001, 0.0, 0.01, "%.4f");
+            flockEdited |= ImGui::DragFloat("Cohesion", &pState->flock.cohesion, 0.0001, 0.0, 0.01, "%.4f");
+            flockEdited |= ImGui::DragFloat("Alignment", &pState->flock.alignment, 0.005, 0.0, 1.0);
+            flockEdited |= ImGui::DragFloat("Wander", &pState->flock.wander, 0.01, 0.0, 1.0);
+        }
+        if (flockEdited)
+            fireflySimulation->setFlocking(pState->flocking, pState->flock);
+        ImGui::Checkbox("Firefly collision with the forest", &pState->fireflyCollision);
+        ImGui::Checkbox("Simulation LOD (random walk)", &pState->simulationLod);
+        if (pState->simulationLod && !pState->flocking)
+            ImGui::Text("Simulated every tick / 2nd / 4th / frozen: %u / %u / %u / %u", pState->lodCounts[0],
+                        pState->lodCounts[1], pState->lodCounts[2], pState->lodCounts[3]);
+        const char* lightAssignments[] = { "All lights", "Per-mesh lists (forward)", "Clustered", "Light tree", "Sampled (deferred)" };
+        ImGui::Combo("Light assignment", &pState->lightAssignment, lightAssignments, 5);
+        ImGui::DragFloat("Light cutoff", &pState->lightCutoff, 0.005, 0.001, 1.0);
+        ImGui::DragFloat("Light tree error bound", &pState->lightTreeErrorBound, 0.001, 0.0, 1.0);
+        ImGui::Text("Light-cluster assignments: %u", pState->clusterAssignments);
+        ImGui::Text("Max lights per cluster: %u", pState->maxLightsPerCluster);
+        ImGui::Text("Light volumes drawn: %u", pState->lightVolumeCount);
+        ImGui::Text("Streaming buffer: %s, %u stalls", pState->streamingPersistent ? "persistently mapped"
+                    : "unsynchronized mapping", pState->streamingStalls);
+        ImGui::Text("GL state calls: %u made, %u redundant ones skipped", pState->stateCalls.issued,
+                    pState->stateCalls.filtered);
+        ImGui::Text("Mesh-light assignments: %u", pState->meshLightAssignments);
+        ImGui::Text("Light tree nodes: %u", pState->lightTreeNodes);
+        ImGui::End();
+    }
     {
         ImGui::Begin("PointLight info");
-        for(int i=0; i<N_FIREFLIES; i++) {
-            ImGui::Text(to_string(i).c_str());
-            ImGui::DragFloat3("Position", (float *) &pointLights[i].position, 0.05, -10, 10);
-            ImGui::DragFloat3("Ambient", (float *) &pointLights[i].ambient, 0.05, 0, 5);
-            ImGui::DragFloat3("Diffuse", (float *) &pointLights[i].diffuse, 0.05, 0, 5);
-            ImGui::DragFloat3("Specular", (float *) &pointLights[i].specular, 0.05, 0, 5);
-            ImGui::DragFloat("Constant", (float*)&pointLights[i].constant, 0.05, 0 ,5);
-            ImGui::DragFloat("Linear", (float*)&pointLights[i].linear, 0.05, 0 ,5);
-            ImGui::DragFloat("Quadratic", (float*)&pointLights[i].quadratic, 0.05, 0 ,5);
+        ImGui::SliderInt("Fireflies", &pState->fireflyCount, 0, fireflyCapacity);
+        // only the visible lights are submitted, there can be many thousands of them
+        ImGuiListClipper clipper;
+        clipper.Begin(nFireflies, ImGui::GetTextLineHeightWithSpacing() + 8 * ImGui::GetFrameHeightWithSpacing());
+        while (clipper.Step())
+        for(int i=clipper.DisplayStart; i<clipper.DisplayEnd; i++) {
+            ImGui::PushID(i);
+            ImGui::Text("%d", i);
+            // positions of the GPU simulation stay on the GPU
+            glm::vec3 position = pointLights[i].position;
+            if (!pState->gpuFireflies && !pState->analyticFireflies && ImGui::DragFloat3("Position", (float *) &position, 0.05, -10, 10))
+                fireflySimulation->setPosition(i, position);
+            bool edited = false;
+            edited |= ImGui::DragFloat3("Ambient", (float *) &pointLights[i].ambient, 0.05, 0, 5);
+            edited |= ImGui::DragFloat3("Diffuse", (float *) &pointLights[i].diffuse, 0.05, 0, 5);
+            edited |= ImGui::DragFloat3("Specular", (float *) &pointLights[i].specular, 0.05, 0, 5);
+            edited |= ImGui::DragFloat("Constant", (float*)&pointLights[i].constant, 0.05, 0 ,5);
+            edited |= ImGui::DragFloat("Linear", (float*)&pointLights[i].linear, 0.05, 0 ,5);
+            edited |= ImGui::DragFloat("Quadratic", (float*)&pointLights[i].quadratic, 0.05, 0 ,5);
+            if (edited)
+                pState->pointLightsEdited = true;
+            if (ImGui::Button("Despawn"))
+                pState->despawnFirefly = i;
+            ImGui::PopID();
         }
         ImGui::End();
     }
@@ -656,7 +1293,7 @@ unsigned int loadRGBACubemap(vector<std::string>& faces){
 
     unsigned int skyboxID;
     glGenTextures(1, &skyboxID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxID);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxID);
 
     int width, height, nrChannels;
     unsigned char *data;
@@ -692,7 +1329,7 @@ void loadVertices(const std::string& filename, float* vertices, int n){
 unsigned int loadRGBATexture(const std::string& path){
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrChannels;
     unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
@@ -728,7 +1365,7 @@ void renderQuad()
         // setup plane VAO
         glGenVertexArrays(1, &quadVAO);
         glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
+        glState().bindVertexArray(quadVAO);
         glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
@@ -736,17 +1373,41 @@ void renderQuad()
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
-    glBindVertexArray(quadVAO);
+    glState().bindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
 }
 
-void generateFireflies(glm::vec3 coords[], int n){
+// uniforms shared by the forward and the deferred lighting shader, the shader has to be in use
+void setLightingUniforms(const Shader &shader, const LightClusterGrid &lightClusters, const LightTree &lightTree) {
+    const DirLight& dirLight = programState->dirLight;
+    shader.setVec3("dirLight.direction", dirLight.direction);
+    shader.setVec3("dirLight.ambient", dirLight.ambient);
+    shader.setVec3("dirLight.diffuse", dirLight.diffuse);
+    shader.setVec3("dirLight.specular", dirLight.specular);
+    shader.setVec3("viewPosition", programState->camera.Position);
+    shader.setInt("nPointLights", nFireflies);
+    shader.setInt("fireflySeed", (int) fireflySeed);
+    shader.setInt("fireflyTime", (int) fireflyTime);
+
+    lightClusters.bind(shader, CLUSTER_RANGES_UNIT, CLUSTER_INDICES_UNIT, SCR_WIDTH, SCR_HEIGHT);
+    lightTree.bind(LIGHT_TREE_UNIT);
+    shader.setInt("lightTreeNodes", LIGHT_TREE_UNIT);
+    shader.setFloat("lightTreeErrorBound", programState->lightTreeErrorBound);
+}
+
+// spawn positions of the fireflies [first, first + n) come from tick 0 of their random streams, so they only
+// depend on the seed and the slot
+void generateFireflies(glm::vec3 coords[], unsigned int first, unsigned int n, uint32_t seed){
+    std::vector<uint32_t> bits[3];
+    for(uint32_t axis=0; axis<3; axis++){
+        bits[axis].resize(n);
+        randomBitsBatch(seed, first, FireflySystem::counter(0, axis), bits[axis].data(), n);
+    }
     float x, y, z;
-    for(int i=0; i<n; i++){
-        x = ((rand() % MAX_RAND) - 100) / 2.0f;
-        y = ((rand() % (Y_LIMIT * 2)) - Y_LIMIT);
-        z = ((rand() % MAX_RAND) - 100) / 2.0f;
+    for(unsigned int i=0; i<n; i++){
+        x = ((int)(bits[0][i] % MAX_RAND) - 100) / 2.0f;
+        y = ((int)(bits[1][i] % (Y_LIMIT * 2)) - Y_LIMIT);
+        z = ((int)(bits[2][i] % MAX_RAND) - 100) / 2.0f;
         coords[i] = {x, y, z};
     }
 }